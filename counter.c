@@ -0,0 +1,82 @@
+#include "counter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define COUNTER_MIN_BUF 4096
+// /proc/stat on very large machines is the biggest file read this way
+#define COUNTER_MAX_BUF (16 * 1024 * 1024)
+
+int counter_init(CounterSource *src, const char *path) {
+  size_t len = strlen(path);
+  src->fd = -1;
+  src->buf = NULL;
+  src->cap = 0;
+  if (len >= sizeof(src->path)) {
+    src->path[0] = '\0';
+    return -1;
+  }
+  memcpy(src->path, path, len + 1);
+  return 0;
+}
+
+static int counter_reopen(CounterSource *src) {
+  if (src->fd >= 0) close(src->fd);
+  src->fd = src->path[0] ? open(src->path, O_RDONLY | O_CLOEXEC) : -1;
+  return src->fd < 0 ? -1 : 0;
+}
+
+const char *counter_read(CounterSource *src, size_t *len) {
+  if (!src->buf) {
+    src->buf = (char *)malloc(COUNTER_MIN_BUF);
+    if (!src->buf) return NULL;
+    src->cap = COUNTER_MIN_BUF;
+  }
+  if (src->fd < 0 && counter_reopen(src) != 0) return NULL;
+
+  int reopened = 0;
+  for (;;) {
+    ssize_t n = pread(src->fd, src->buf, src->cap - 1, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      // The file may have gone away and come back (hotplug, driver reload)
+      if (reopened++ || counter_reopen(src) != 0) return NULL;
+      continue;
+    }
+
+    // A full buffer may mean a truncated read: grow and read it again
+    if ((size_t)n == src->cap - 1 && src->cap < COUNTER_MAX_BUF) {
+      char *grown = (char *)realloc(src->buf, src->cap * 2);
+      if (!grown) return NULL;
+      src->buf = grown;
+      src->cap *= 2;
+      continue;
+    }
+
+    src->buf[n] = '\0';
+    if (len) *len = (size_t)n;
+    return src->buf;
+  }
+}
+
+int counter_read_ull(CounterSource *src, unsigned long long *out) {
+  const char *s = counter_read(src, NULL);
+  if (!s) return 0;
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(s, &end, 10);
+  if (end == s || errno) return 0;
+  *out = value;
+  return 1;
+}
+
+void counter_close(CounterSource *src) {
+  if (src->fd >= 0) close(src->fd);
+  src->fd = -1;
+  free(src->buf);
+  src->buf = NULL;
+  src->cap = 0;
+}
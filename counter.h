@@ -0,0 +1,25 @@
+#ifndef COUNTER_H
+#define COUNTER_H
+#include <stddef.h>
+
+#define COUNTER_PATH_LEN 256
+
+// A /proc or /sys file that is sampled over and over. The file is opened
+// once and re-read from offset 0 into a buffer kept between reads; it is
+// only reopened after a read error.
+typedef struct {
+  char path[COUNTER_PATH_LEN];
+  int fd;
+  char *buf;
+  size_t cap;
+} CounterSource;
+
+#define COUNTER_SOURCE_INIT(p) { p, -1, NULL, 0 }
+
+int counter_init(CounterSource *src, const char *path);
+// Whole file contents, NUL terminated, valid until the next read or close.
+// Returns NULL if the file cannot be read.
+const char *counter_read(CounterSource *src, size_t *len);
+int counter_read_ull(CounterSource *src, unsigned long long *out);
+void counter_close(CounterSource *src);
+#endif
@@ -1,37 +1,51 @@
 #include "modules.h"
 
-float cpu_perc() {
-  static long double a[7] = {0};
-  long double b[7], sum;
-  //if(skip_read) return 0;
-
-  memcpy(b, a, sizeof(b));
-
-  FILE *fp = fopen("/proc/stat", "r");
-  if (!fp) {
-      perror("Failed to open /proc/stat");
-      return -1;
+// Share of the interval spent busy (user, nice, system, irq, softirq)
+float cpu_times_perc(const CpuTimes *prev, const CpuTimes *cur) {
+  static const CpuTimeField busy_fields[] = { CPU_USER, CPU_NICE, CPU_SYSTEM, CPU_IRQ, CPU_SOFTIRQ };
+  static const CpuTimeField idle_fields[] = { CPU_IDLE, CPU_IOWAIT };
+  unsigned long long busy = 0, idle = 0;
+
+  for (int i = 0; i < 5; i++) {
+    CpuTimeField f = busy_fields[i];
+    if (cur->t[f] > prev->t[f]) busy += cur->t[f] - prev->t[f];
   }
-
-  if (fscanf(fp, "cpu  %Lf %Lf %Lf %Lf %Lf %Lf %Lf",
-             &a[0], &a[1], &a[2], &a[3], &a[4], &a[5], &a[6]) != 7) {
-      fclose(fp);
-      return -1;
+  for (int i = 0; i < 2; i++) {
+    CpuTimeField f = idle_fields[i];
+    if (cur->t[f] > prev->t[f]) idle += cur->t[f] - prev->t[f];
   }
-  fclose(fp);
 
-  if (b[0] == 0) {
+  if (busy + idle == 0) {
       return -1;
   }
+  return (float)(100.0 * (double)busy / (double)(busy + idle));
+}
 
-  sum = (b[0] + b[1] + b[2] + b[3] + b[4] + b[5] + b[6]) -
-        (a[0] + a[1] + a[2] + a[3] + a[4] + a[5] + a[6]);
-
-  if (sum == 0) {
+float cpu_perc(const SysStat *prev, const SysStat *cur) {
+  if (!prev->valid || !cur->valid) {
       return -1;
   }
-
-  return (float)(100 * ((b[0] + b[1] + b[2] + b[5] + b[6]) -
-                      (a[0] + a[1] + a[2] + a[5] + a[6])) / sum);
+  return cpu_times_perc(&prev->total, &cur->total);
 }
 
+// Per-core utilization for every cpuN line in cur, in file order.
+// Cores without a previous sample (just came online) read as -1.
+void cpu_core_percs(const SysStat *prev, const SysStat *cur, float *out) {
+  for (int i = 0; i < cur->cpu_count; i++) {
+    const CpuTimes *c = &cur->cpus[i];
+    const CpuTimes *p = NULL;
+
+    // Same order as last time unless CPUs went on/offline
+    if (i < prev->cpu_count && prev->cpus[i].id == c->id) {
+      p = &prev->cpus[i];
+    } else {
+      for (int j = 0; j < prev->cpu_count; j++) {
+        if (prev->cpus[j].id == c->id) {
+          p = &prev->cpus[j];
+          break;
+        }
+      }
+    }
+    out[i] = p ? cpu_times_perc(p, c) : -1;
+  }
+}
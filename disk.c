@@ -1,87 +1,220 @@
 #include "modules.h"
 
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <linux/netlink.h>
 #include <ctype.h>
+#include <errno.h>
 #include <time.h>
 
-double calculate_disk_busy(const char *disk) {
-    char line[512];
-    static struct {
-        char disk_name[32];
-        long long time_spent;
-        struct timespec timestamp;
-    } prev_stats[32] = {0}; // Cache for up to 32 disks
-    static int num_tracked_disks = 0;
-    
-    long long curr_time_spent = 0;
-    struct timespec curr_time;
-    clock_gettime(CLOCK_MONOTONIC, &curr_time);
-    
-    // Look for this disk in our previous stats
-    int disk_idx = -1;
-    for (int i = 0; i < num_tracked_disks; i++) {
-        if (strcmp(prev_stats[i].disk_name, disk) == 0) {
-            disk_idx = i;
-            break;
-        }
+#include "counter.h"
+
+static CounterSource diskstats_src = COUNTER_SOURCE_INIT("/proc/diskstats");
+
+#define DISK_TABLE_MIN_CAP 16
+
+// Every device line of /proc/diskstats, refreshed by one pass per tick.
+// Entries are kept in file order; index is an open-addressing table
+// (linear probing, power-of-two size, at most half full) of entry + 1.
+static struct {
+    DiskStat *entries;
+    int count;
+    int cap;
+    int *index;
+    int index_cap;
+    unsigned int generation;
+    int passes;
+    struct timespec last_pass;
+} disk_table;
+
+static unsigned int disk_name_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    while (*name) h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+static void disk_table_reindex(void) {
+    memset(disk_table.index, 0, (size_t)disk_table.index_cap * sizeof(int));
+    unsigned int mask = (unsigned int)disk_table.index_cap - 1;
+    for (int i = 0; i < disk_table.count; i++) {
+        unsigned int slot = disk_name_hash(disk_table.entries[i].name) & mask;
+        while (disk_table.index[slot]) slot = (slot + 1) & mask;
+        disk_table.index[slot] = i + 1;
     }
-    
-    // Open /proc/diskstats to get current stats
-    FILE *file = fopen("/proc/diskstats", "r");
-    if (!file) {
-        perror("Failed to open /proc/diskstats");
-        return -1.0;
+}
+
+static int disk_table_reserve(int needed) {
+    if (needed <= disk_table.cap) return 0;
+    int cap = disk_table.cap ? disk_table.cap : DISK_TABLE_MIN_CAP;
+    while (cap < needed) cap *= 2;
+
+    // Both allocations succeed before either capacity changes
+    int *index = (int *)malloc((size_t)cap * 2 * sizeof(int));
+    if (!index) return -1;
+    DiskStat *entries = (DiskStat *)realloc(disk_table.entries, (size_t)cap * sizeof(DiskStat));
+    if (!entries) {
+        free(index);
+        return -1;
     }
-    
-    // Find the specified disk and extract its busy time
-    while (fgets(line, sizeof(line), file)) {
-        char dev_name[32];
-        long long major, minor, reads, writes, ios_in_progress, time_spent;
-        int fields = sscanf(line, "%lld %lld %31s %lld %lld %lld %lld %lld %lld %lld %lld",
-                            &major, &minor, dev_name, &reads, &writes, &writes,
-                            &writes, &writes, &writes, &ios_in_progress, &time_spent);
-        if (fields >= 11 && strcmp(dev_name, disk) == 0) {
-            curr_time_spent = time_spent;
-            
-            // If this is a new disk or first time seeing it
-            if (disk_idx == -1) {
-                // If we have room, add it to our tracking
-                if (num_tracked_disks < 32) {
-                    disk_idx = num_tracked_disks++;
-                    strncpy(prev_stats[disk_idx].disk_name, disk, sizeof(prev_stats[disk_idx].disk_name) - 1);
-                    prev_stats[disk_idx].disk_name[sizeof(prev_stats[disk_idx].disk_name) - 1] = '\0';
-                    prev_stats[disk_idx].time_spent = curr_time_spent;
-                    prev_stats[disk_idx].timestamp = curr_time;
-                    fclose(file);
-                    return 0.0; // First reading, return 0
-                }
-            } else {
-                // Calculate time difference in milliseconds
-                double time_diff = (curr_time.tv_sec - prev_stats[disk_idx].timestamp.tv_sec) * 1000.0 +
-                                 (curr_time.tv_nsec - prev_stats[disk_idx].timestamp.tv_nsec) / 1000000.0;
-                
-                // Calculate busy percentage
-                double busy_percent = 0.0;
-                if (time_diff > 0) {
-                    busy_percent = (curr_time_spent - prev_stats[disk_idx].time_spent) / (time_diff / 10.0);
-                    
-                    // Cap at 100%
-                    if (busy_percent > 100.0) busy_percent = 100.0;
-                }
-                
-                // Update previous values
-                prev_stats[disk_idx].time_spent = curr_time_spent;
-                prev_stats[disk_idx].timestamp = curr_time;
-                
-                fclose(file);
-                return busy_percent;
-            }
-            break;
+    disk_table.entries = entries;
+    disk_table.cap = cap;
+    free(disk_table.index);
+    disk_table.index = index;
+    disk_table.index_cap = cap * 2;
+    disk_table_reindex();
+    return 0;
+}
+
+static DiskStat *disk_table_lookup(const char *name, int create) {
+    if (disk_table.index_cap) {
+        unsigned int mask = (unsigned int)disk_table.index_cap - 1;
+        for (unsigned int slot = disk_name_hash(name) & mask; disk_table.index[slot]; slot = (slot + 1) & mask) {
+            DiskStat *d = &disk_table.entries[disk_table.index[slot] - 1];
+            if (strcmp(d->name, name) == 0) return d;
         }
     }
-    
-    fclose(file);
-    return -1.0; // Disk not found
+    if (!create || disk_table_reserve(disk_table.count + 1) != 0) return NULL;
+
+    // reserve() may have reindexed, so probe again for a free slot
+    unsigned int mask = (unsigned int)disk_table.index_cap - 1;
+    unsigned int slot = disk_name_hash(name) & mask;
+    while (disk_table.index[slot]) slot = (slot + 1) & mask;
+
+    DiskStat *d = &disk_table.entries[disk_table.count];
+    memset(d, 0, sizeof(*d));
+    strcpy(d->name, name);
+    disk_table.index[slot] = ++disk_table.count;
+    return d;
+}
+
+// Drop devices that were not in the last pass (hot-unplug, removed loop
+// or dm devices). Rare, so the index is simply rebuilt.
+static int disk_table_evict_stale(void) {
+    int kept = 0;
+    for (int i = 0; i < disk_table.count; i++) {
+        if (disk_table.entries[i].generation != disk_table.generation) continue;
+        if (kept != i) disk_table.entries[kept] = disk_table.entries[i];
+        kept++;
+    }
+    if (kept == disk_table.count) return 0;
+    disk_table.count = kept;
+    disk_table_reindex();
+    return 1;
+}
+
+static const char *diskstat_skip_spaces(const char *p) {
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+static const char *diskstat_parse_ull(const char *p, unsigned long long *out) {
+    unsigned long long v = 0;
+    while (*p >= '0' && *p <= '9') v = v * 10 + (unsigned long long)(*p++ - '0');
+    *out = v;
+    return p;
+}
+
+// "major minor name f0 f1 ...": returns the number of counters parsed
+static int diskstat_parse_line(const char *p, char *name, size_t name_size, unsigned long long *fields) {
+    unsigned long long ignored;
+    p = diskstat_parse_ull(diskstat_skip_spaces(p), &ignored);
+    p = diskstat_parse_ull(diskstat_skip_spaces(p), &ignored);
+    p = diskstat_skip_spaces(p);
+
+    size_t len = 0;
+    while (*p && *p != ' ' && *p != '\n') {
+        if (len + 1 < name_size) name[len++] = *p;
+        p++;
+    }
+    name[len] = '\0';
+
+    int n = 0;
+    for (; n < DISKSTAT_FIELDS; n++) {
+        p = diskstat_skip_spaces(p);
+        if (*p < '0' || *p > '9') break;
+        p = diskstat_parse_ull(p, &fields[n]);
+    }
+    for (int i = n; i < DISKSTAT_FIELDS; i++) fields[i] = 0;
+    return len ? n : 0;
+}
+
+// Counter increase since the previous pass (0 if it went backwards)
+static double diskstat_delta(const DiskStat *d, int field) {
+    return d->fields[field] >= d->prev[field] ? (double)(d->fields[field] - d->prev[field]) : 0.0;
+}
+
+static void disk_stat_metrics(DiskStat *d) {
+    double *m = d->metrics;
+    memset(m, 0, sizeof(d->metrics));
+    m[DISK_QUEUE] = (double)d->fields[DISKSTAT_IN_FLIGHT];
+    if (d->interval_ms <= 0) return;
+
+    double secs = d->interval_ms / 1000.0;
+    // io_ticks counts milliseconds with at least one request in flight
+    m[DISK_BUSY] = diskstat_delta(d, DISKSTAT_IO_TICKS) * 100.0 / d->interval_ms;
+    if (m[DISK_BUSY] > 100.0) m[DISK_BUSY] = 100.0;
+
+    // Sectors are always 512 bytes here, whatever the device block size
+    m[DISK_READ_BPS] = diskstat_delta(d, DISKSTAT_READ_SECTORS) * 512.0 / secs;
+    m[DISK_WRITE_BPS] = diskstat_delta(d, DISKSTAT_WRITE_SECTORS) * 512.0 / secs;
+
+    double reads = diskstat_delta(d, DISKSTAT_READS);
+    double writes = diskstat_delta(d, DISKSTAT_WRITES);
+    m[DISK_READ_IOPS] = reads / secs;
+    m[DISK_WRITE_IOPS] = writes / secs;
+    if (reads + writes > 0) {
+        m[DISK_AWAIT] = (diskstat_delta(d, DISKSTAT_READ_MS) + diskstat_delta(d, DISKSTAT_WRITE_MS)) / (reads + writes);
+    }
+
+    m[DISK_DISCARD_IOPS] = diskstat_delta(d, DISKSTAT_DISCARDS) / secs;
+    m[DISK_FLUSH_IOPS] = diskstat_delta(d, DISKSTAT_FLUSHES) / secs;
+}
+
+// Read /proc/diskstats once and update every device from that pass.
+// Returns 1 if devices appeared or went away since the last pass.
+int disk_stats_update(void) {
+    const char *line = counter_read(&diskstats_src, NULL);
+    if (!line) return -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed_ms = 0.0;
+    if (disk_table.passes++) {
+        elapsed_ms = (now.tv_sec - disk_table.last_pass.tv_sec) * 1000.0 +
+                     (now.tv_nsec - disk_table.last_pass.tv_nsec) / 1000000.0;
+    }
+    disk_table.last_pass = now;
+
+    disk_table.generation++;
+    if (disk_table.generation == 0) disk_table.generation = 1;
+
+    int changed = 0;
+    char name[DISK_NAME_LEN];
+    unsigned long long fields[DISKSTAT_FIELDS];
+    for (const char *next; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next) next++;
+
+        // Lines without io_ticks (the 10th counter) carry nothing we use
+        if (diskstat_parse_line(line, name, sizeof(name), fields) <= DISKSTAT_IO_TICKS) continue;
+
+        DiskStat *d = disk_table_lookup(name, 1);
+        if (!d) continue;
+        if (d->samples == 0) changed = 1;
+        memcpy(d->prev, d->fields, sizeof(d->prev));
+        memcpy(d->fields, fields, sizeof(d->fields));
+        d->generation = disk_table.generation;
+        d->interval_ms = d->samples++ ? elapsed_ms : 0.0;
+
+        disk_stat_metrics(d);
+    }
+
+    if (disk_table_evict_stale()) changed = 1;
+    return changed;
+}
+
+const DiskStat *disk_stats_find(const char *name) {
+    return disk_table_lookup(name, 0);
 }
 
 // Function to check if a device is a disk (HDD or SSD)
@@ -122,72 +255,136 @@ const char* get_disk_type(const char *device_name) {
 }
 
 
-DiskInfo* get_disk_info(int *count) {
-    DIR *dir;
-    struct dirent *entry;
-    DiskInfo *disks = NULL;
-    int max_disks = 10;
-    int disk_count = 0;
-    
-    // Allocate initial memory for disk info
-    disks = (DiskInfo*)malloc(max_disks * sizeof(DiskInfo));
-    if (!disks) {
-        perror("Memory allocation failed");
-        *count = 0;
-        return NULL;
+// Whole-disk block devices from /sys/block. Rebuilt only when the device
+// set changes, so the type lookup is not repeated every tick.
+static struct {
+    DiskInfo *disks;
+    int count;
+    int cap;
+} disk_inventory;
+
+static int disk_info_cmp(const void *a, const void *b) {
+    return strcmp(((const DiskInfo *)a)->device_name, ((const DiskInfo *)b)->device_name);
+}
+
+static const DiskInfo *disk_inventory_find(const char *name) {
+    for (int i = 0; i < disk_inventory.count; i++) {
+        if (strcmp(disk_inventory.disks[i].device_name, name) == 0) return &disk_inventory.disks[i];
     }
-    
-    // Open /sys/block directory
-    dir = opendir("/sys/block");
+    return NULL;
+}
+
+int disk_inventory_refresh(void) {
+    DIR *dir = opendir("/sys/block");
     if (!dir) {
         perror("Failed to open /sys/block");
-        free(disks);
-        *count = 0;
-        return NULL;
+        return -1;
     }
-    
-    // Iterate through all devices
+
+    DiskInfo *disks = NULL;
+    int count = 0, cap = 0;
+    struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.') {
-            continue; // Skip hidden directories
-        }
-        
-        if (is_disk_device(entry->d_name)) {
-            // Resize array if needed
-            if (disk_count >= max_disks) {
-                max_disks *= 2;
-                DiskInfo *temp = (DiskInfo*)realloc(disks, max_disks * sizeof(DiskInfo));
-                if (!temp) {
-                    perror("Memory reallocation failed");
-                    free(disks);
-                    closedir(dir);
-                    *count = 0;
-                    return NULL;
-                }
-                disks = temp;
+        if (entry->d_name[0] == '.') continue; // Skip hidden directories
+        if (!is_disk_device(entry->d_name)) continue;
+
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            DiskInfo *grown = (DiskInfo *)realloc(disks, (size_t)cap * sizeof(DiskInfo));
+            if (!grown) {
+                perror("Memory reallocation failed");
+                free(disks);
+                closedir(dir);
+                return -1;
             }
-            
-            // Store disk information
-            strncpy(disks[disk_count].device_name, entry->d_name, sizeof(disks[disk_count].device_name) - 1);
-            disks[disk_count].device_name[sizeof(disks[disk_count].device_name) - 1] = '\0';
-            
-            const char *disk_type = get_disk_type(entry->d_name);
-            strncpy(disks[disk_count].disk_type, disk_type, sizeof(disks[disk_count].disk_type) - 1);
-            disks[disk_count].disk_type[sizeof(disks[disk_count].disk_type) - 1] = '\0';
-            
-            disks[disk_count].busy_percent = calculate_disk_busy(entry->d_name);
-            
-            // Always include the disk, even on first reading when busy_percent is 0
-            disk_count++;
+            disks = grown;
         }
+
+        DiskInfo *disk = &disks[count++];
+        memset(disk, 0, sizeof(*disk));
+        strncpy(disk->device_name, entry->d_name, sizeof(disk->device_name) - 1);
+        disk->slot = -1;
+
+        // Known disks keep their type; only new ones hit sysfs
+        const DiskInfo *known = disk_inventory_find(disk->device_name);
+        const char *disk_type = known ? known->disk_type : get_disk_type(entry->d_name);
+        strncpy(disk->disk_type, disk_type, sizeof(disk->disk_type) - 1);
     }
-    
     closedir(dir);
-    *count = disk_count;
-    return disks;
+
+    // readdir order is arbitrary; keep boxes in a stable order
+    if (count > 1) qsort(disks, (size_t)count, sizeof(DiskInfo), disk_info_cmp);
+
+    free(disk_inventory.disks);
+    disk_inventory.disks = disks;
+    disk_inventory.count = count;
+    disk_inventory.cap = cap;
+    return count;
+}
+
+// Copy up to max inventory disks with the metrics of the last diskstats pass
+int disk_inventory_sample(DiskInfo *out, int max) {
+    int count = disk_inventory.count < max ? disk_inventory.count : max;
+    for (int i = 0; i < count; i++) {
+        out[i] = disk_inventory.disks[i];
+        const DiskStat *stat = disk_stats_find(out[i].device_name);
+        if (stat) {
+            memcpy(out[i].metrics, stat->metrics, sizeof(out[i].metrics));
+        } else {
+            for (int m = 0; m < DISK_METRIC_COUNT; m++) out[i].metrics[m] = -1.0;
+        }
+    }
+    return count;
+}
+
+void disk_inventory_free(void) {
+    free(disk_inventory.disks);
+    memset(&disk_inventory, 0, sizeof(disk_inventory));
 }
 
-// Function to free disk info
-void free_disk_info(DiskInfo *disks) {
-    free(disks);
+// Kernel uevents, so hotplug is noticed without polling /sys/block
+int disk_uevent_open(void) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) return -1;
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; // kernel events (udev re-broadcasts on group 2)
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Drain queued uevents. Returns 1 if any concerned a block device (or
+// some were lost), 0 otherwise.
+int disk_uevent_pending(int fd) {
+    if (fd < 0) return 0;
+
+    char buf[8192];
+    int pending = 0;
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) {
+                pending = 1; // overflowed: assume the worst
+                continue;
+            }
+            break;
+        }
+        if (n == 0) break;
+        buf[n] = '\0';
+
+        // "action@devpath\0KEY=value\0KEY=value\0..."
+        for (const char *kv = buf; kv < buf + n; kv += strlen(kv) + 1) {
+            if (strcmp(kv, "SUBSYSTEM=block") == 0) {
+                pending = 1;
+                break;
+            }
+        }
+    }
+    return pending;
 }
@@ -1,28 +1,45 @@
 #include "modules.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "counter.h"
+
+#define NVIDIA_VENDOR 0x10de
+
+typedef struct {
+  char name[GPU_NAME_LEN];     // "card0", or "nvidia0" without a DRM card
+  char device_path[PATH_MAX];  // empty when only nvidia-smi knows the GPU
+  unsigned int vendor_id;      // 0x10de, 0x1002, 0x8086
+  unsigned int pci_key;        // domain/bus/device/function, 0 if unknown
+  int nvsmi_index;             // -1 until nvidia-smi reports it
+  // Sysfs counters re-read every tick
+  CounterSource busy_src;
+  CounterSource vram_used_src;
+  CounterSource vram_total_src;
+  // Latest nvidia-smi line for this GPU
+  int nv_have;
+  int nv_util;
+  unsigned long long nv_used_mib;
+  unsigned long long nv_total_mib;
+  struct timespec nv_last;
+} GpuDevice;
 
 typedef struct {
   short initialized;
-  short available;
-  char device_path[PATH_MAX];
-  unsigned int vendor_id; // 0x10de, 0x1002, 0x8086
+  short nvidia; // run nvidia-smi
+  int count;
+  GpuDevice devices[MAX_GPUS];
 } GpuCtx;
 
 static GpuCtx gpu_ctx = {0};
 
-static int read_file_ull(const char *path, unsigned long long *out) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) return 0;
-  unsigned long long value = 0;
-  int ok = fscanf(fp, "%llu", &value) == 1;
-  fclose(fp);
-  if (!ok) return 0;
-  *out = value;
-  return 1;
-}
-
 static int read_file_hex_uint(const char *path, unsigned int *out) {
   FILE *fp = fopen(path, "r");
   if (!fp) return 0;
@@ -48,75 +65,115 @@ static int build_path(char *dst, size_t dstsz, const char *base, const char *suf
   return 1;
 }
 
+// "0000:01:00.0" (sysfs) and "00000000:01:00.0" (nvidia-smi) compare equal
+static unsigned int pci_key_parse(const char *bus_id) {
+  unsigned int domain, bus, dev, fn;
+  if (sscanf(bus_id, " %x:%x:%x.%x", &domain, &bus, &dev, &fn) != 4) return 0;
+  return ((domain & 0xffff) << 16) | ((bus & 0xff) << 8) | ((dev & 0x1f) << 3) | (fn & 0x7);
+}
+
+static unsigned int drm_pci_key(const char *card) {
+  char link[PATH_MAX], target[PATH_MAX];
+  snprintf(link, sizeof(link), "/sys/class/drm/%s/device", card);
+  ssize_t n = readlink(link, target, sizeof(target) - 1);
+  if (n <= 0) return 0;
+  target[n] = '\0';
+  const char *base = strrchr(target, '/');
+  return pci_key_parse(base ? base + 1 : target);
+}
+
+static GpuDevice *gpu_add_device(const char *name) {
+  if (gpu_ctx.count >= MAX_GPUS) return NULL;
+  GpuDevice *gpu = &gpu_ctx.devices[gpu_ctx.count++];
+  memset(gpu, 0, sizeof(*gpu));
+  snprintf(gpu->name, sizeof(gpu->name), "%s", name);
+  gpu->nvsmi_index = -1;
+  counter_init(&gpu->busy_src, "");
+  counter_init(&gpu->vram_used_src, "");
+  counter_init(&gpu->vram_total_src, "");
+  return gpu;
+}
+
+static int card_number(const char *name) {
+  return atoi(name + 4);
+}
+
+static int card_cmp(const void *a, const void *b) {
+  return card_number(((const GpuDevice *)a)->name) - card_number(((const GpuDevice *)b)->name);
+}
+
+// Every DRM card with a PCI vendor; NVIDIA GPUs without a card (no
+// nvidia-drm) are added later as nvidia-smi reports them.
 static void gpu_try_init() {
   if (gpu_ctx.initialized) return;
   gpu_ctx.initialized = 1;
-  gpu_ctx.available = 0;
-  gpu_ctx.device_path[0] = '\0';
-  gpu_ctx.vendor_id = 0;
+  gpu_ctx.count = 0;
 
   DIR *dir = opendir("/sys/class/drm");
-  if (!dir) return;
-
-  struct dirent *ent;
-  while ((ent = readdir(dir)) != NULL) {
-    // Look for cardN
-    if (strncmp(ent->d_name, "card", 4) != 0) continue;
-    if (!isdigit((unsigned char)ent->d_name[4])) continue;
-
-    char vendor_path[PATH_MAX];
-    snprintf(vendor_path, sizeof(vendor_path), "/sys/class/drm/%s/device/vendor", ent->d_name);
-
-    unsigned int vendor = 0;
-    if (!read_file_hex_uint(vendor_path, &vendor)) continue;
-    if (vendor == 0) continue;
-
-    // Filter out vgem and similar (vendor 0x0000 or missing device)
-    char device_dir[PATH_MAX];
-    snprintf(device_dir, sizeof(device_dir), "/sys/class/drm/%s/device", ent->d_name);
-    if (!file_exists(device_dir)) continue;
-
-    // Found a GPU-like device
-    strncpy(gpu_ctx.device_path, device_dir, sizeof(gpu_ctx.device_path));
-    gpu_ctx.device_path[sizeof(gpu_ctx.device_path) - 1] = '\0';
-    gpu_ctx.vendor_id = vendor;
-    gpu_ctx.available = 1;
-    break;
+  if (dir) {
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+      // Look for cardN, skipping connectors (cardN-HDMI-A-1, ...)
+      if (strncmp(ent->d_name, "card", 4) != 0) continue;
+      if (!isdigit((unsigned char)ent->d_name[4])) continue;
+      if (strchr(ent->d_name, '-')) continue;
+
+      char vendor_path[PATH_MAX];
+      snprintf(vendor_path, sizeof(vendor_path), "/sys/class/drm/%s/device/vendor", ent->d_name);
+
+      unsigned int vendor = 0;
+      if (!read_file_hex_uint(vendor_path, &vendor)) continue;
+      if (vendor == 0) continue;
+
+      // Filter out vgem and similar (vendor 0x0000 or missing device)
+      char device_dir[PATH_MAX];
+      snprintf(device_dir, sizeof(device_dir), "/sys/class/drm/%s/device", ent->d_name);
+      if (!file_exists(device_dir)) continue;
+
+      GpuDevice *gpu = gpu_add_device(ent->d_name);
+      if (!gpu) break;
+      snprintf(gpu->device_path, sizeof(gpu->device_path), "%s", device_dir);
+      gpu->vendor_id = vendor;
+      gpu->pci_key = drm_pci_key(ent->d_name);
+      if (vendor == NVIDIA_VENDOR) gpu_ctx.nvidia = 1;
+    }
+    closedir(dir);
+  }
+
+  // readdir order is arbitrary; card numbers give a stable box order
+  qsort(gpu_ctx.devices, (size_t)gpu_ctx.count, sizeof(GpuDevice), card_cmp);
+  for (int i = 0; i < gpu_ctx.count; i++) {
+    GpuDevice *gpu = &gpu_ctx.devices[i];
+    char path[PATH_MAX];
+    if (build_path(path, sizeof(path), gpu->device_path, "/gpu_busy_percent"))
+      counter_init(&gpu->busy_src, path);
+    if (build_path(path, sizeof(path), gpu->device_path, "/mem_info_vram_used"))
+      counter_init(&gpu->vram_used_src, path);
+    if (build_path(path, sizeof(path), gpu->device_path, "/mem_info_vram_total"))
+      counter_init(&gpu->vram_total_src, path);
   }
 
-  closedir(dir);
+  // The NVIDIA driver can be loaded without any DRM card
+  if (file_exists("/proc/driver/nvidia/version") || getenv("VITALS_NVIDIA_SMI")) gpu_ctx.nvidia = 1;
 }
 
 short gpu_available() {
   gpu_try_init();
-  return gpu_ctx.available;
+  return gpu_ctx.count > 0 || gpu_ctx.nvidia;
 }
 
-static int read_gpu_busy_percent_sysfs(int *out_percent) {
-  if (!gpu_ctx.available) return 0;
-
-  char path[PATH_MAX];
-  if (!build_path(path, sizeof(path), gpu_ctx.device_path, "/gpu_busy_percent")) return 0;
-
+static int read_gpu_busy_percent_sysfs(GpuDevice *gpu, int *out_percent) {
   unsigned long long busy = 0;
-  if (!read_file_ull(path, &busy)) return 0;
+  if (!counter_read_ull(&gpu->busy_src, &busy)) return 0;
   if (busy > 100) busy = 100;
   *out_percent = (int)busy;
   return 1;
 }
 
-static int read_vram_sysfs(unsigned long long *used_bytes, unsigned long long *total_bytes) {
-  if (!gpu_ctx.available) return 0;
-
-  char used_path[PATH_MAX];
-  char total_path[PATH_MAX];
-
-  if (!build_path(used_path, sizeof(used_path), gpu_ctx.device_path, "/mem_info_vram_used")) return 0;
-  if (!build_path(total_path, sizeof(total_path), gpu_ctx.device_path, "/mem_info_vram_total")) return 0;
-
+static int read_vram_sysfs(GpuDevice *gpu, unsigned long long *used_bytes, unsigned long long *total_bytes) {
   unsigned long long used = 0, total = 0;
-  if (!read_file_ull(used_path, &used)) return 0;
-  if (!read_file_ull(total_path, &total)) return 0;
+  if (!counter_read_ull(&gpu->vram_used_src, &used)) return 0;
+  if (!counter_read_ull(&gpu->vram_total_src, &total)) return 0;
   if (total == 0) return 0;
 
   *used_bytes = used;
@@ -124,80 +181,246 @@ static int read_vram_sysfs(unsigned long long *used_bytes, unsigned long long *t
   return 1;
 }
 
-static int read_nvidia_smi(int *gpu_util_percent, unsigned long long *mem_used_bytes, unsigned long long *mem_total_bytes) {
-  FILE *fp = popen("nvidia-smi --query-gpu=utilization.gpu,memory.used,memory.total --format=csv,noheader,nounits 2>/dev/null", "r");
-  if (!fp) return 0;
+// nvidia-smi is expensive to start (driver init), so one instance runs for
+// the whole session with --loop-ms and its CSV stream is read without
+// blocking. It prints one line per GPU per interval.
+// VITALS_NVIDIA_SMI overrides the binary (e.g. a stub that prints CSV).
+#define NVSMI_QUERY "--query-gpu=index,pci.bus_id,utilization.gpu,memory.used,memory.total"
+#define NVSMI_LINE_LEN 4096
+// Don't respawn a failing nvidia-smi more often than this
+#define NVSMI_RESTART_MS 5000
+
+typedef struct {
+  pid_t pid;
+  int fd;
+  char line[NVSMI_LINE_LEN];
+  size_t line_len;
+  int interval_ms;
+  struct timespec started;
+} NvSmi;
+
+static NvSmi nvsmi = { .pid = -1, .fd = -1, .interval_ms = 1000 };
+
+static double nvsmi_ms_since(const struct timespec *t) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - t->tv_sec) * 1000.0 + (now.tv_nsec - t->tv_nsec) / 1000000.0;
+}
+
+static void nvsmi_stop() {
+  if (nvsmi.fd >= 0) close(nvsmi.fd);
+  nvsmi.fd = -1;
+  if (nvsmi.pid > 0) {
+    kill(nvsmi.pid, SIGTERM);
+    waitpid(nvsmi.pid, NULL, 0);
+  }
+  nvsmi.pid = -1;
+  nvsmi.line_len = 0;
+}
 
-  char line[256];
-  if (!fgets(line, sizeof(line), fp)) {
-    pclose(fp);
-    return 0;
+static int nvsmi_start() {
+  const char *bin = getenv("VITALS_NVIDIA_SMI");
+  if (!bin || !*bin) bin = "nvidia-smi";
+  char interval[32];
+  snprintf(interval, sizeof(interval), "--loop-ms=%d", nvsmi.interval_ms);
+  char *const argv[] = { (char *)bin, NVSMI_QUERY, "--format=csv,noheader,nounits", interval, NULL };
+
+  clock_gettime(CLOCK_MONOTONIC, &nvsmi.started);
+
+  int fds[2];
+  if (pipe(fds) != 0) return -1;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    // Only async-signal-safe calls until exec
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    dup2(fds[1], STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+    execvp(bin, argv);
+    _exit(127);
   }
-  pclose(fp);
 
-  int util = -1;
-  unsigned long long used_mib = 0, total_mib = 0;
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  nvsmi.pid = pid;
+  nvsmi.fd = fds[0];
+  nvsmi.line_len = 0;
+  return 0;
+}
 
-  // Expected: "12, 345, 7982" (with optional spaces)
-  if (sscanf(line, " %d , %llu , %llu", &util, &used_mib, &total_mib) != 3) {
-    return 0;
+// The device a line belongs to: matched on PCI address, then on index;
+// GPUs without a DRM card get a device of their own.
+static GpuDevice *nvsmi_device(int index, unsigned int pci_key) {
+  for (int i = 0; i < gpu_ctx.count; i++) {
+    GpuDevice *gpu = &gpu_ctx.devices[i];
+    if (gpu->nvsmi_index == index) return gpu;
+    if (pci_key && gpu->pci_key == pci_key) {
+      gpu->nvsmi_index = index;
+      return gpu;
+    }
   }
 
-  if (util < 0) util = 0;
-  if (util > 100) util = 100;
+  char name[GPU_NAME_LEN];
+  snprintf(name, sizeof(name), "nvidia%d", index);
+  GpuDevice *gpu = gpu_add_device(name);
+  if (!gpu) return NULL;
+  gpu->vendor_id = NVIDIA_VENDOR;
+  gpu->pci_key = pci_key;
+  gpu->nvsmi_index = index;
+  return gpu;
+}
 
-  *gpu_util_percent = util;
-  *mem_used_bytes = used_mib * 1024ULL * 1024ULL;
-  *mem_total_bytes = total_mib * 1024ULL * 1024ULL;
+// A numeric CSV field; values a GPU does not report read "[N/A]" or
+// "[Not Supported]"
+static int nvsmi_field(const char *field, unsigned long long *out) {
+  while (*field == ' ') field++;
+  if (!isdigit((unsigned char)*field)) return 0;
+  *out = strtoull(field, NULL, 10);
   return 1;
 }
 
-float gpu_perc() {
-  gpu_try_init();
-  if (!gpu_ctx.available) return -1;
+// Expected: "0, 00000000:01:00.0, 12, 345, 7982"
+// (index, bus id, util %, used MiB, total MiB)
+static void nvsmi_parse_line(const char *line) {
+  int index = -1, pos = 0;
+  char bus_id[32];
+  if (sscanf(line, " %d , %31[^,] ,%n", &index, bus_id, &pos) != 2 || !pos || index < 0) return;
+
+  // util, used, total
+  unsigned long long values[3] = {0};
+  int have[3];
+  const char *field = line + pos;
+  for (int i = 0; i < 3; i++) {
+    if (!field) return;
+    have[i] = nvsmi_field(field, &values[i]);
+    field = strchr(field, ',');
+    if (field) field++;
+  }
+
+  GpuDevice *gpu = nvsmi_device(index, pci_key_parse(bus_id));
+  if (!gpu) return;
 
-  int util = -1;
+  gpu->nv_util = have[0] ? (values[0] > 100 ? 100 : (int)values[0]) : -1;
+  gpu->nv_used_mib = values[1];
+  gpu->nv_total_mib = have[1] && have[2] ? values[2] : 0;
+  gpu->nv_have = 1;
+  clock_gettime(CLOCK_MONOTONIC, &gpu->nv_last);
+}
 
-  // Prefer sysfs busy percent when available (AMD/Intel)
-  if (read_gpu_busy_percent_sysfs(&util)) {
-    return (float)util;
+// Consume whatever the coprocess wrote since the last tick; restart it if
+// it exited. Never blocks.
+static void nvsmi_poll() {
+  if (nvsmi.fd < 0) {
+    if (nvsmi.pid < 0 && nvsmi.started.tv_sec && nvsmi_ms_since(&nvsmi.started) < NVSMI_RESTART_MS) return;
+    if (nvsmi_start() != 0) return;
   }
 
-  // NVIDIA fallback: nvidia-smi
-  if (gpu_ctx.vendor_id == 0x10de) {
-    unsigned long long used_b = 0, total_b = 0;
-    if (read_nvidia_smi(&util, &used_b, &total_b)) {
-      return (float)util;
+  for (;;) {
+    ssize_t n = read(nvsmi.fd, nvsmi.line + nvsmi.line_len, sizeof(nvsmi.line) - 1 - nvsmi.line_len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      nvsmi_stop();
+      return;
+    }
+    if (n == 0) {
+      // Exited (driver reset, killed, not installed): respawn later
+      nvsmi_stop();
+      return;
+    }
+    nvsmi.line_len += (size_t)n;
+    nvsmi.line[nvsmi.line_len] = '\0';
+
+    char *start = nvsmi.line;
+    char *nl;
+    while ((nl = strchr(start, '\n')) != NULL) {
+      *nl = '\0';
+      nvsmi_parse_line(start);
+      start = nl + 1;
     }
+    nvsmi.line_len -= (size_t)(start - nvsmi.line);
+    memmove(nvsmi.line, start, nvsmi.line_len);
+    // A line that long is garbage; drop it
+    if (nvsmi.line_len == sizeof(nvsmi.line) - 1) nvsmi.line_len = 0;
   }
+}
+
+// Latest values for one GPU, or 0 if there are none or they went stale.
+// util is -1 and the total 0 for what nvidia-smi did not report.
+static int read_nvidia_smi(const GpuDevice *gpu, int *gpu_util_percent, unsigned long long *mem_used_bytes, unsigned long long *mem_total_bytes) {
+  if (!gpu->nv_have) return 0;
+  double stale_ms = nvsmi.interval_ms * 3.0 < NVSMI_RESTART_MS ? NVSMI_RESTART_MS : nvsmi.interval_ms * 3.0;
+  if (nvsmi_ms_since(&gpu->nv_last) > stale_ms) return 0;
+
+  *gpu_util_percent = gpu->nv_util;
+  *mem_used_bytes = gpu->nv_used_mib * 1024ULL * 1024ULL;
+  *mem_total_bytes = gpu->nv_total_mib * 1024ULL * 1024ULL;
+  return 1;
+}
+
+void gpu_set_interval(int ms) {
+  if (ms < 1) ms = 1;
+  if (ms == nvsmi.interval_ms) return;
+  nvsmi.interval_ms = ms;
+  // Pick up the new interval on the next poll
+  if (nvsmi.pid > 0) {
+    nvsmi_stop();
+    nvsmi.started.tv_sec = 0;
+  }
+}
 
-  return -1;
+void gpu_shutdown() {
+  nvsmi_stop();
+  for (int i = 0; i < gpu_ctx.count; i++) {
+    counter_close(&gpu_ctx.devices[i].busy_src);
+    counter_close(&gpu_ctx.devices[i].vram_used_src);
+    counter_close(&gpu_ctx.devices[i].vram_total_src);
+  }
+}
+
+static float vram_perc_of(unsigned long long used_b, unsigned long long total_b) {
+  double perc = (double)used_b * 100.0 / (double)total_b;
+  if (perc < 0) perc = 0;
+  if (perc > 100) perc = 100;
+  return (float)perc;
 }
 
-float vram_perc() {
+// Sample every GPU in one pass: sysfs per card, plus everything nvidia-smi
+// printed since the last call. Returns the number of entries written;
+// util/vram are -1 where unavailable.
+int gpu_sample(GpuSample *out, int max) {
   gpu_try_init();
-  if (!gpu_ctx.available) return -1;
+  if (gpu_ctx.nvidia) nvsmi_poll();
 
-  unsigned long long used_b = 0, total_b = 0;
+  int count = gpu_ctx.count < max ? gpu_ctx.count : max;
+  for (int i = 0; i < count; i++) {
+    GpuDevice *gpu = &gpu_ctx.devices[i];
+    GpuSample *s = &out[i];
+    snprintf(s->name, sizeof(s->name), "%s", gpu->name);
+    s->util = -1;
+    s->vram = -1;
 
-  // Sysfs path (typically amdgpu; sometimes other drivers)
-  if (read_vram_sysfs(&used_b, &total_b)) {
-    double perc = (double)used_b * 100.0 / (double)total_b;
-    if (perc < 0) perc = 0;
-    if (perc > 100) perc = 100;
-    return (float)perc;
-  }
+    int util = -1;
+    unsigned long long used_b = 0, total_b = 0;
 
-  // NVIDIA fallback: nvidia-smi
-  if (gpu_ctx.vendor_id == 0x10de) {
-    int util = 0;
-    if (read_nvidia_smi(&util, &used_b, &total_b) && total_b > 0) {
-      double perc = (double)used_b * 100.0 / (double)total_b;
-      if (perc < 0) perc = 0;
-      if (perc > 100) perc = 100;
-      return (float)perc;
+    // Prefer sysfs when available (amdgpu; busy percent also on some Intel)
+    if (gpu->device_path[0]) {
+      if (read_gpu_busy_percent_sysfs(gpu, &util)) s->util = (float)util;
+      if (read_vram_sysfs(gpu, &used_b, &total_b)) s->vram = vram_perc_of(used_b, total_b);
     }
-  }
 
-  return -1;
+    // NVIDIA: both values come from the same nvidia-smi line
+    if (gpu->vendor_id == NVIDIA_VENDOR && read_nvidia_smi(gpu, &util, &used_b, &total_b)) {
+      if (s->util < 0) s->util = (float)util;
+      if (s->vram < 0 && total_b > 0) s->vram = vram_perc_of(used_b, total_b);
+    }
+  }
+  return count;
 }
@@ -0,0 +1,352 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "snapshot.h"
+
+#define METRICS_REQUEST_MAX 4096
+// A scraper gets this long to send its request and read the reply
+#define METRICS_IO_TIMEOUT_MS 2000
+
+// Growable response body; kept between scrapes so steady state does not allocate
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} MetricsBuf;
+
+static void buf_printf(MetricsBuf *buf, const char *fmt, ...) {
+  for (;;) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = buf->cap - buf->len;
+    int n = vsnprintf(buf->data ? buf->data + buf->len : NULL, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < room) {
+      buf->len += (size_t)n;
+      return;
+    }
+    size_t cap = buf->cap ? buf->cap * 2 : 16384;
+    while (cap - buf->len <= (size_t)n) cap *= 2;
+    char *data = (char *)realloc(buf->data, cap);
+    if (!data) return;
+    buf->data = data;
+    buf->cap = cap;
+  }
+}
+
+// Label values escape backslash, double quote and newline
+static void buf_label(MetricsBuf *buf, const char *value) {
+  char escaped[2 * PROC_COMM_LEN + 1];
+  size_t n = 0;
+  for (const char *p = value; *p && n + 2 < sizeof(escaped); p++) {
+    if (*p == '\\' || *p == '"') escaped[n++] = '\\';
+    if (*p == '\n') {
+      escaped[n++] = '\\';
+      escaped[n++] = 'n';
+      continue;
+    }
+    escaped[n++] = *p;
+  }
+  escaped[n] = '\0';
+  buf_printf(buf, "%s", escaped);
+}
+
+static void buf_header(MetricsBuf *buf, const char *name, const char *help) {
+  buf_printf(buf, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+}
+
+typedef struct {
+  const char *name;
+  const char *help;
+  double scale; // from the DiskInfo unit
+} DiskMetricInfo;
+
+static const DiskMetricInfo disk_metrics[DISK_METRIC_COUNT] = {
+  [DISK_BUSY] = {"vitals_disk_busy_percent", "Time the disk had I/O in flight.", 1},
+  [DISK_READ_BPS] = {"vitals_disk_read_bytes_per_second", "Bytes read per second.", 1},
+  [DISK_WRITE_BPS] = {"vitals_disk_write_bytes_per_second", "Bytes written per second.", 1},
+  [DISK_READ_IOPS] = {"vitals_disk_reads_per_second", "Completed reads per second.", 1},
+  [DISK_WRITE_IOPS] = {"vitals_disk_writes_per_second", "Completed writes per second.", 1},
+  [DISK_AWAIT] = {"vitals_disk_await_seconds", "Average time per completed request.", 0.001},
+  [DISK_QUEUE] = {"vitals_disk_queue_depth", "Requests in flight.", 1},
+  [DISK_DISCARD_IOPS] = {"vitals_disk_discards_per_second", "Completed discards per second.", 1},
+  [DISK_FLUSH_IOPS] = {"vitals_disk_flushes_per_second", "Completed flushes per second.", 1},
+};
+
+// Rows of the METRICS_TOP_PROCS busiest processes, busiest first. Only the
+// columns are read: the stats thread may still reorder keys/order.
+static int top_procs(const ProcTable *table, int *rows) {
+  int n = 0;
+  for (int r = 0; r < table->count; r++) {
+    int pos = n;
+    while (pos > 0 && table->cpu_percent[rows[pos - 1]] < table->cpu_percent[r]) pos--;
+    if (pos >= METRICS_TOP_PROCS) continue;
+    if (n < METRICS_TOP_PROCS) n++;
+    memmove(rows + pos + 1, rows + pos, (size_t)(n - 1 - pos) * sizeof(int));
+    rows[pos] = r;
+  }
+  return n;
+}
+
+static void metrics_render(MetricsBuf *buf, const Snapshot *snap) {
+  buf->len = 0;
+  buf_header(buf, "vitals_cpu_percent", "CPU utilization over the last interval.");
+  if (snap->cpu >= 0) buf_printf(buf, "vitals_cpu_percent %.1f\n", snap->cpu);
+  buf_header(buf, "vitals_memory_percent", "Memory in use.");
+  if (snap->mem >= 0) buf_printf(buf, "vitals_memory_percent %.1f\n", snap->mem);
+
+  if (snap->net_interface[0]) {
+    buf_header(buf, "vitals_network_receive_bytes_per_second", "Bytes received per second.");
+    buf_printf(buf, "vitals_network_receive_bytes_per_second{interface=\"");
+    buf_label(buf, snap->net_interface);
+    buf_printf(buf, "\"} %lu\n", snap->net_down);
+    buf_header(buf, "vitals_network_transmit_bytes_per_second", "Bytes sent per second.");
+    buf_printf(buf, "vitals_network_transmit_bytes_per_second{interface=\"");
+    buf_label(buf, snap->net_interface);
+    buf_printf(buf, "\"} %lu\n", snap->net_up);
+  }
+
+  for (int m = 0; m < DISK_METRIC_COUNT && snap->disk_count > 0; m++) {
+    buf_header(buf, disk_metrics[m].name, disk_metrics[m].help);
+    for (int i = 0; i < snap->disk_count; i++) {
+      if (snap->disks[i].metrics[m] < 0) continue;
+      buf_printf(buf, "%s{device=\"", disk_metrics[m].name);
+      buf_label(buf, snap->disks[i].device_name);
+      buf_printf(buf, "\"} %g\n", snap->disks[i].metrics[m] * disk_metrics[m].scale);
+    }
+  }
+
+  if (snap->gpu_count > 0) {
+    buf_header(buf, "vitals_gpu_utilization_percent", "GPU busy percent.");
+    for (int i = 0; i < snap->gpu_count; i++) {
+      if (snap->gpus[i].util < 0) continue;
+      buf_printf(buf, "vitals_gpu_utilization_percent{gpu=\"");
+      buf_label(buf, snap->gpus[i].name);
+      buf_printf(buf, "\"} %.1f\n", snap->gpus[i].util);
+    }
+    buf_header(buf, "vitals_gpu_memory_used_percent", "GPU memory in use.");
+    for (int i = 0; i < snap->gpu_count; i++) {
+      if (snap->gpus[i].vram < 0) continue;
+      buf_printf(buf, "vitals_gpu_memory_used_percent{gpu=\"");
+      buf_label(buf, snap->gpus[i].name);
+      buf_printf(buf, "\"} %.1f\n", snap->gpus[i].vram);
+    }
+  }
+
+  const ProcTable *table = snap->proc_table;
+  if (table && table->count > 0) {
+    int rows[METRICS_TOP_PROCS];
+    int n = top_procs(table, rows);
+    buf_header(buf, "vitals_process_cpu_percent", "CPU use of the busiest processes.");
+    for (int i = 0; i < n; i++) {
+      buf_printf(buf, "vitals_process_cpu_percent{pid=\"%d\",comm=\"", table->pid[rows[i]]);
+      buf_label(buf, table->comm[rows[i]]);
+      buf_printf(buf, "\"} %.1f\n", table->cpu_percent[rows[i]]);
+    }
+    buf_header(buf, "vitals_process_resident_bytes", "Resident memory of the busiest processes.");
+    for (int i = 0; i < n; i++) {
+      buf_printf(buf, "vitals_process_resident_bytes{pid=\"%d\",comm=\"", table->pid[rows[i]]);
+      buf_label(buf, table->comm[rows[i]]);
+      buf_printf(buf, "\"} %lu\n", table->rss_kb[rows[i]] * 1024UL);
+    }
+  }
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    data += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+static void metrics_reply(int fd, MetricsBuf *body) {
+  char req[METRICS_REQUEST_MAX];
+  size_t len = 0;
+  // Only the request line matters; wait for the end of the headers
+  while (len < sizeof(req) - 1) {
+    ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return;
+    len += (size_t)n;
+    req[len] = '\0';
+    if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+  }
+  req[len] = '\0';
+
+  const char *status = "200 OK";
+  if (strncmp(req, "GET ", 4) != 0) {
+    status = "405 Method Not Allowed";
+  } else if (strncmp(req + 4, "/metrics ", 9) != 0 && strncmp(req + 4, "/metrics?", 9) != 0) {
+    status = "404 Not Found";
+  }
+
+  if (strcmp(status, "200 OK") == 0) {
+    Snapshot *snap = snapshot_acquire();
+    if (snap) {
+      metrics_render(body, snap);
+      snapshot_release(snap);
+    } else {
+      status = "503 Service Unavailable";
+    }
+  }
+  size_t body_len = strcmp(status, "200 OK") == 0 ? body->len : 0;
+
+  char head[256];
+  int head_len = snprintf(head, sizeof(head),
+                          "HTTP/1.1 %s\r\n"
+                          "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n\r\n",
+                          status, body_len);
+  if (write_all(fd, head, (size_t)head_len) != 0) return;
+  if (body_len) write_all(fd, body->data, body_len);
+}
+
+// One connection at a time: scrapes are rare and each reply is built from
+// an already published snapshot.
+static void *metrics_thread(void *arg) {
+  MetricsServer *server = (MetricsServer *)arg;
+  MetricsBuf body = {0};
+  struct pollfd fds[2] = {
+    {.fd = server->listen_fd, .events = POLLIN},
+    {.fd = server->wake_fds[0], .events = POLLIN},
+  };
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[1].revents) break;
+    if (!(fds[0].revents & POLLIN)) continue;
+
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0) continue;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    struct timeval tv = {METRICS_IO_TIMEOUT_MS / 1000, (METRICS_IO_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    metrics_reply(fd, &body);
+    close(fd);
+  }
+  free(body.data);
+  return NULL;
+}
+
+// Remove a socket at path; anything else there is left alone (EADDRINUSE)
+static int unlink_socket(const char *path) {
+  struct stat st;
+  if (lstat(path, &st) != 0) return errno == ENOENT ? 0 : -1;
+  if (!S_ISSOCK(st.st_mode)) {
+    errno = EADDRINUSE;
+    return -1;
+  }
+  return unlink(path);
+}
+
+static int metrics_listen(MetricsServer *server, const char *addr) {
+  if (strncmp(addr, "unix:", 5) == 0) {
+    struct sockaddr_un sun = {.sun_family = AF_UNIX};
+    const char *path = addr + 5;
+    if (!*path || strlen(path) >= sizeof(sun.sun_path)) {
+      errno = EINVAL;
+      return -1;
+    }
+    strcpy(sun.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    // A socket left by an instance that did not shut down cleanly
+    if (unlink_socket(path) != 0 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0 || listen(fd, 16) != 0) {
+      int err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+    strcpy(server->unix_path, path);
+    return fd;
+  }
+
+  struct sockaddr_in sin = {.sin_family = AF_INET};
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const char *port = addr;
+  const char *colon = strrchr(addr, ':');
+  if (colon) {
+    char host[INET_ADDRSTRLEN];
+    size_t host_len = (size_t)(colon - addr);
+    if (host_len >= sizeof(host)) {
+      errno = EINVAL;
+      return -1;
+    }
+    memcpy(host, addr, host_len);
+    host[host_len] = '\0';
+    if (inet_pton(AF_INET, host, &sin.sin_addr) != 1) {
+      errno = EINVAL;
+      return -1;
+    }
+    port = colon + 1;
+  }
+  char *end;
+  long port_num = strtol(port, &end, 10);
+  if (end == port || *end || port_num < 1 || port_num > 65535) {
+    errno = EINVAL;
+    return -1;
+  }
+  sin.sin_port = htons((unsigned short)port_num);
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 || listen(fd, 16) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+int metrics_start(MetricsServer *server, const char *addr) {
+  memset(server, 0, sizeof(*server));
+  server->wake_fds[0] = server->wake_fds[1] = -1;
+  server->listen_fd = metrics_listen(server, addr);
+  if (server->listen_fd < 0) return -1;
+  // pthread_create returns its error instead of setting errno
+  int err = pipe(server->wake_fds) != 0 ? errno : pthread_create(&server->thread, NULL, metrics_thread, server);
+  if (err) {
+    close(server->listen_fd);
+    if (server->wake_fds[0] >= 0) close(server->wake_fds[0]);
+    if (server->wake_fds[1] >= 0) close(server->wake_fds[1]);
+    if (server->unix_path[0]) unlink_socket(server->unix_path);
+    server->listen_fd = -1;
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+void metrics_stop(MetricsServer *server) {
+  if (server->listen_fd < 0) return;
+  char c = 1;
+  ssize_t rv = write(server->wake_fds[1], &c, 1);
+  (void)rv;
+  pthread_join(server->thread, NULL);
+  close(server->listen_fd);
+  close(server->wake_fds[0]);
+  close(server->wake_fds[1]);
+  if (server->unix_path[0]) unlink_socket(server->unix_path);
+  server->listen_fd = -1;
+}
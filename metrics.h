@@ -0,0 +1,23 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <sys/un.h>
+
+// Prometheus text exposition over HTTP (GET /metrics), answered from the
+// latest published snapshot. A scrape never reads /proc itself.
+#define METRICS_TOP_PROCS 10
+
+typedef struct {
+  int listen_fd;
+  int wake_fds[2]; // stop request
+  char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  pthread_t thread;
+} MetricsServer;
+
+// addr is "PORT" (127.0.0.1), "HOST:PORT" with an IPv4 literal, or
+// "unix:PATH". Returns -1 and sets errno on failure.
+int metrics_start(MetricsServer *server, const char *addr);
+void metrics_stop(MetricsServer *server);
+
+#endif
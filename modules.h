@@ -8,26 +8,85 @@
 #include <dirent.h>
 
 #include "process.h"
+#include "sysstat.h"
 
 float mem_perc();
-float cpu_perc();
+float cpu_perc(const SysStat *prev, const SysStat *cur);
+float cpu_times_perc(const CpuTimes *prev, const CpuTimes *cur);
+void cpu_core_percs(const SysStat *prev, const SysStat *cur, float *out);
+#define MAX_GPUS 8
+#define GPU_NAME_LEN 16
+
+typedef struct {
+  char name[GPU_NAME_LEN];
+  float util; // %, -1 if unavailable
+  float vram; // % used, -1 if unavailable
+} GpuSample;
+
 short gpu_available();
-float gpu_perc();
-float vram_perc();
+int gpu_sample(GpuSample *out, int max);
+void gpu_set_interval(int ms);
+void gpu_shutdown();
 void get_active_interface(char *interface, size_t size);
 void get_network_speed( unsigned long *rx_speed, unsigned long *tx_speed, char *net_interface);
 void format_speed(char *buffer, size_t size, unsigned long bytes_per_sec);
 
 
+// Per-disk rates derived from two diskstats passes
+typedef enum {
+    DISK_BUSY = 0,     // % of the interval with I/O in flight
+    DISK_READ_BPS,
+    DISK_WRITE_BPS,
+    DISK_READ_IOPS,
+    DISK_WRITE_IOPS,
+    DISK_AWAIT,        // ms per completed read/write
+    DISK_QUEUE,        // requests in flight at sample time
+    DISK_DISCARD_IOPS,
+    DISK_FLUSH_IOPS,
+    DISK_METRIC_COUNT
+} DiskMetric;
+
 typedef struct {
     char device_name[32];
     char disk_type[8];
-    double busy_percent;
+    double metrics[DISK_METRIC_COUNT];
+    int slot; // history slot picked by the UI, -1 until assigned
 } DiskInfo;
+#define DISK_NAME_LEN 32
+// Counters after the device name in /proc/diskstats (kernel 5.5+ layout;
+// older kernels stop after 11 or 15 and the rest read as zero)
+#define DISKSTAT_FIELDS 17
+enum {
+    DISKSTAT_READS = 0,
+    DISKSTAT_READ_SECTORS = 2,
+    DISKSTAT_READ_MS = 3,
+    DISKSTAT_WRITES = 4,
+    DISKSTAT_WRITE_SECTORS = 6,
+    DISKSTAT_WRITE_MS = 7,
+    DISKSTAT_IN_FLIGHT = 8,
+    DISKSTAT_IO_TICKS = 9,
+    DISKSTAT_DISCARDS = 11,
+    DISKSTAT_FLUSHES = 15
+};
+
+typedef struct {
+    char name[DISK_NAME_LEN];
+    unsigned long long fields[DISKSTAT_FIELDS];
+    unsigned long long prev[DISKSTAT_FIELDS];
+    double interval_ms; // between prev and fields, 0 on the first sample
+    unsigned int samples;
+    unsigned int generation;
+    double metrics[DISK_METRIC_COUNT];
+} DiskStat;
+
 short is_disk_device(const char *device_name);
 const char* get_disk_type(const char *device_name);
-double calculate_disk_busy(const char *disk);
-DiskInfo* get_disk_info(int *count);
-void free_disk_info(DiskInfo *disks);
+int disk_stats_update(void);
+const DiskStat *disk_stats_find(const char *name);
+int disk_inventory_refresh(void);
+int disk_inventory_sample(DiskInfo *out, int max);
+void disk_inventory_free(void);
+int disk_uevent_open(void);
+int disk_uevent_pending(int fd);
 
 #endif
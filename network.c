@@ -1,10 +1,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "counter.h"
+
 #define PROC_NET_DEV "/proc/net/dev"
 
+static CounterSource net_dev_src = COUNTER_SOURCE_INIT(PROC_NET_DEV);
+
 // Function to detect the primary active network interface
 void get_active_interface(char *interface, size_t size) {
     FILE *fp = fopen(PROC_NET_DEV, "r");
@@ -36,35 +41,36 @@ void get_active_interface(char *interface, size_t size) {
 
 // Function to get network usage (upload and download in bytes)
 void get_network_usage(unsigned long *rx_bytes, unsigned long *tx_bytes, char *net_interface) {
-    FILE *fp = fopen("/proc/net/dev", "r");
-    if (fp == NULL) {
-        perror("Error opening /proc/net/dev");
-        exit(1);
+    const char *dev = counter_read(&net_dev_src, NULL);
+    if (dev == NULL) {
+        // Keep the previous totals so the speed reads as zero
+        return;
     }
 
-    char line[256];
-    while (fgets(line, sizeof(line), fp)) {
-        if (strstr(line, net_interface)) {
-            sscanf(line, "%*s %lu %*u %*u %*u %*u %*u %*u %*u %lu", rx_bytes, tx_bytes);
-            break;
-        }
+    const char *line = strstr(dev, net_interface);
+    if (line) {
+        sscanf(line, "%*s %lu %*u %*u %*u %*u %*u %*u %*u %lu", rx_bytes, tx_bytes);
     }
-    fclose(fp);
 }
 
-// Function to calculate network speed (bytes per second)
+// Bytes per second since the previous call, over the measured elapsed time
 void get_network_speed( unsigned long *rx_speed, unsigned long *tx_speed, char *net_interface) {
     static short first_read = 1;
     static unsigned long rx1 = 0;
     static unsigned long tx1 = 0;
     static unsigned long rx2 = 0;
     static unsigned long tx2 = 0;
-    
+    static struct timespec t1;
+    struct timespec t2;
+
     get_network_usage(&rx2, &tx2, net_interface);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    double secs = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+    t1 = t2;
 
-    if(!first_read){
-      *rx_speed = rx2 - rx1;
-      *tx_speed = tx2 - tx1;
+    if(!first_read && secs > 0){
+      *rx_speed = (unsigned long)((rx2 - rx1) / secs);
+      *tx_speed = (unsigned long)((tx2 - tx1) / secs);
     }else{
       *rx_speed = 0;
       *tx_speed = 0;
@@ -3,27 +3,33 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-static unsigned long long read_total_jiffies(void) {
-    FILE *fp = fopen("/proc/stat", "r");
-    if (!fp) return 0;
-
-    // cpu  user nice system idle iowait irq softirq steal guest guest_nice
-    unsigned long long v[10] = {0};
-    int n = fscanf(fp, "cpu  %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
-                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]);
-    fclose(fp);
-    if (n < 4) return 0;
-
-    unsigned long long sum = 0;
-    for (int i = 0; i < 10; i++) sum += v[i];
-    return sum;
-}
+#define PROC_DENTS_BUF (32 * 1024)
+// Processes without a DRM fd get their fd table rechecked once per this
+// many passes (spread over pids); known DRM clients every pass.
+#define PROC_DRM_RESCAN_PASSES 8
+// Distinct DRM clients (drm-client-id) counted per process
+#define PROC_DRM_MAX_CLIENTS 32
+
+// Record layout returned by getdents64(2)
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
 
 static unsigned long long read_mem_total_kb(void) {
     FILE *fp = fopen("/proc/meminfo", "r");
@@ -47,34 +53,139 @@ int proc_init_ctx(ProcSampleCtx *ctx) {
     memset(ctx, 0, sizeof(*ctx));
     ctx->page_size = sysconf(_SC_PAGESIZE);
     ctx->mem_total_kb = (unsigned long)read_mem_total_kb();
-    ctx->last_total_jiffies = read_total_jiffies();
 
     ctx->pid_samples = NULL;
     ctx->pid_samples_count = 0;
     ctx->pid_samples_cap = 0;
+    ctx->scan_workers = 1;
+
+    ctx->proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ctx->dents_buf = (char *)malloc(PROC_DENTS_BUF);
+    if (ctx->proc_fd < 0 || !ctx->dents_buf) {
+        proc_free_ctx(ctx);
+        return -1;
+    }
     return 0;
 }
 
-static ProcPidSample *find_or_create_pid_sample(ProcSampleCtx *ctx, int pid) {
-    for (int i = 0; i < ctx->pid_samples_count; i++) {
-        if (ctx->pid_samples[i].pid == pid) return &ctx->pid_samples[i];
+// Restart the /proc listing from the first entry
+static int proc_dir_rewind(ProcSampleCtx *ctx) {
+    ctx->dents_len = 0;
+    ctx->dents_pos = 0;
+    if (lseek(ctx->proc_fd, 0, SEEK_SET) == 0) return 0;
+
+    // Should not happen, but recover by reopening /proc
+    close(ctx->proc_fd);
+    ctx->proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return ctx->proc_fd < 0 ? -1 : 0;
+}
+
+static struct linux_dirent64 *proc_dir_next(ProcSampleCtx *ctx) {
+    if (ctx->dents_pos >= ctx->dents_len) {
+        long n = syscall(SYS_getdents64, ctx->proc_fd, ctx->dents_buf, PROC_DENTS_BUF);
+        if (n <= 0) return NULL;
+        ctx->dents_len = (int)n;
+        ctx->dents_pos = 0;
     }
+    struct linux_dirent64 *ent = (struct linux_dirent64 *)(ctx->dents_buf + ctx->dents_pos);
+    ctx->dents_pos += ent->d_reclen;
+    return ent;
+}
 
-    if (ctx->pid_samples_count >= ctx->pid_samples_cap) {
-        int new_cap = (ctx->pid_samples_cap == 0) ? 256 : (ctx->pid_samples_cap * 2);
-        ProcPidSample *tmp = (ProcPidSample *)realloc(ctx->pid_samples, (size_t)new_cap * sizeof(ProcPidSample));
-        if (!tmp) return NULL;
-        ctx->pid_samples = tmp;
-        ctx->pid_samples_cap = new_cap;
+// Fibonacci hashing: the slot is the top log2(cap) bits of pid * 2^32/phi,
+// which spreads sequential pids across the table. cap is a power of two.
+static unsigned int pid_hash(int pid, int cap) {
+    unsigned int h = (unsigned int)pid * 2654435761u;
+    return (unsigned int)(((unsigned long long)h * (unsigned int)cap) >> 32);
+}
+
+static ProcPidSample *pid_table_probe(ProcPidSample *table, int cap, int pid) {
+    unsigned int mask = (unsigned int)cap - 1;
+    unsigned int i = pid_hash(pid, cap);
+    while (table[i].pid != 0 && table[i].pid != pid) i = (i + 1) & mask;
+    return &table[i];
+}
+
+#define PID_TABLE_MIN_CAP 1024
+
+static int pid_table_resize(ProcSampleCtx *ctx, int new_cap) {
+    ProcPidSample *tmp = (ProcPidSample *)calloc((size_t)new_cap, sizeof(ProcPidSample));
+    if (!tmp) return -1;
+
+    for (int i = 0; i < ctx->pid_samples_cap; i++) {
+        if (ctx->pid_samples[i].pid == 0) continue;
+        *pid_table_probe(tmp, new_cap, ctx->pid_samples[i].pid) = ctx->pid_samples[i];
     }
 
-    ProcPidSample *slot = &ctx->pid_samples[ctx->pid_samples_count++];
-    slot->pid = pid;
+    free(ctx->pid_samples);
+    ctx->pid_samples = tmp;
+    ctx->pid_samples_cap = new_cap;
+    return 0;
+}
+
+static ProcPidSample *find_or_create_pid_sample(ProcSampleCtx *ctx, int pid, unsigned long long starttime) {
+    if ((ctx->pid_samples_count + 1) * 2 > ctx->pid_samples_cap) {
+        int new_cap = (ctx->pid_samples_cap == 0) ? PID_TABLE_MIN_CAP : (ctx->pid_samples_cap * 2);
+        if (pid_table_resize(ctx, new_cap) != 0) return NULL;
+    }
+
+    ProcPidSample *slot = pid_table_probe(ctx->pid_samples, ctx->pid_samples_cap, pid);
+    if (slot->pid == 0) {
+        slot->pid = pid;
+        ctx->pid_samples_count++;
+    } else if (slot->starttime == starttime) {
+        slot->generation = ctx->generation;
+        return slot;
+    }
+
+    // New pid, or the old process exited and its pid was reused
+    slot->starttime = starttime;
     slot->last_proc_time = 0;
+    slot->last_gpu_ns = 0;
+    slot->has_drm = 0;
+    slot->generation = ctx->generation;
     return slot;
 }
 
-static int name_matches_filter(const char *comm, const char *filter) {
+// Backward-shift deletion keeps probe chains intact without tombstones.
+static void pid_table_remove_at(ProcSampleCtx *ctx, unsigned int i) {
+    ProcPidSample *table = ctx->pid_samples;
+    unsigned int mask = (unsigned int)ctx->pid_samples_cap - 1;
+    unsigned int j = i;
+
+    for (;;) {
+        table[i].pid = 0;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (table[j].pid == 0) {
+                ctx->pid_samples_count--;
+                return;
+            }
+            // Entries whose home slot lies cyclically in (i, j] stay put
+            unsigned int k = pid_hash(table[j].pid, ctx->pid_samples_cap);
+            if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+            break;
+        }
+        table[i] = table[j];
+        i = j;
+    }
+}
+
+// Drop every pid the current pass did not see, then shrink if mostly empty.
+static void pid_table_evict_stale(ProcSampleCtx *ctx) {
+    for (int i = 0; i < ctx->pid_samples_cap; i++) {
+        // A shift may pull another stale entry into slot i, so recheck it
+        while (ctx->pid_samples[i].pid != 0 && ctx->pid_samples[i].generation != ctx->generation) {
+            pid_table_remove_at(ctx, (unsigned int)i);
+        }
+    }
+
+    if (ctx->pid_samples_cap > PID_TABLE_MIN_CAP && ctx->pid_samples_count * 8 < ctx->pid_samples_cap) {
+        pid_table_resize(ctx, ctx->pid_samples_cap / 2);
+    }
+}
+
+int proc_name_matches(const char *comm, const char *filter) {
     if (!filter || !*filter) return 1;
 
     // case-insensitive substring match
@@ -90,79 +201,370 @@ static int name_matches_filter(const char *comm, const char *filter) {
     return 0;
 }
 
-static int read_proc_stat(int pid, char *comm_out, size_t comm_sz, char *state_out,
-                          int *ppid_out, unsigned long long *utime_out, unsigned long long *stime_out,
-                          unsigned long long *starttime_out, unsigned long long *vsize_out, long *rss_pages_out) {
-    char path[64];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-    FILE *fp = fopen(path, "r");
-    if (!fp) return -1;
+// Decode one (possibly negative) decimal field and step past the separator.
+// Values are accumulated unsigned, so u64 fields like rsslim wrap harmlessly.
+static const char *stat_next_field(const char *p, const char *end, long long *out) {
+    int neg = 0;
+    if (p < end && *p == '-') {
+        neg = 1;
+        p++;
+    }
+    unsigned long long v = 0;
+    while (p < end && (unsigned char)(*p - '0') < 10) {
+        v = v * 10 + (unsigned long long)(*p - '0');
+        p++;
+    }
+    *out = neg ? -(long long)v : (long long)v;
+    return (p < end) ? p + 1 : p;
+}
+
+// Parse a /proc/[pid]/stat line in one left-to-right pass.
+static int parse_proc_stat(const char *buf, size_t len, ProcStat *st) {
+    const char *end = buf + len;
+
+    // pid (comm) state ppid ... ; comm can contain spaces and ')' so use the last ')'
+    const char *l = memchr(buf, '(', len);
+    const char *r = end;
+    while (r > buf && *--r != ')');
+    if (!l || r <= l || r + 4 > end) return -1;
 
+    size_t comm_len = (size_t)(r - l - 1);
+    if (comm_len >= sizeof(st->comm)) comm_len = sizeof(st->comm) - 1;
+    memcpy(st->comm, l + 1, comm_len);
+    st->comm[comm_len] = '\0';
+
+    // field 3 state, then numeric fields from 4 on
+    const char *p = r + 2;
+    st->state = *p;
+    p += 2;
+
+    for (int field = 4; field <= 39 && p < end; field++) {
+        long long v;
+        p = stat_next_field(p, end, &v);
+        switch (field) {
+            case 4: st->ppid = (int)v; break;
+            case 10: st->minflt = (unsigned long)v; break;
+            case 12: st->majflt = (unsigned long)v; break;
+            case 14: st->utime = (unsigned long long)v; break;
+            case 15: st->stime = (unsigned long long)v; break;
+            case 18: st->priority = (int)v; break;
+            case 19: st->nice = (int)v; break;
+            case 20: st->num_threads = (int)v; break;
+            case 22: st->starttime = (unsigned long long)v; break;
+            case 23: st->vsize = (unsigned long long)v; break;
+            case 24: st->rss_pages = (long)v; break;
+            case 39: st->processor = (int)v; break;
+            default: break;
+        }
+    }
+    return 0;
+}
+
+// "<pid><suffix>", relative to the /proc fd, without going through printf.
+// Returns the length.
+static int pid_path(char *path, int pid, const char *suffix) {
+    char digits[12];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + pid % 10);
+        pid /= 10;
+    } while (pid > 0);
+
+    int len = 0;
+    while (n > 0) path[len++] = digits[--n];
+    size_t suffix_len = strlen(suffix);
+    memcpy(path + len, suffix, suffix_len + 1);
+    return len + (int)suffix_len;
+}
+
+static int read_proc_stat(int proc_fd, int pid, ProcStat *st) {
+    char path[32];
+    pid_path(path, pid, "/stat");
+    int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    // One read() is enough: the kernel renders the whole line at once
     char buf[4096];
-    if (!fgets(buf, sizeof(buf), fp)) {
-        fclose(fp);
-        return -1;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (n <= 0) return -1;
+
+    memset(st, 0, sizeof(*st));
+    st->drm_fds = -1;
+    return parse_proc_stat(buf, (size_t)n, st);
+}
+
+// "123 KiB" (or MiB/GiB, or plain bytes) in KiB
+static unsigned long fdinfo_kb(const char *p) {
+    char *end;
+    unsigned long long v = strtoull(p, &end, 10);
+    while (*end == ' ' || *end == '\t') end++;
+    if (end[0] == 'K') return (unsigned long)v;
+    if (end[0] == 'M') return (unsigned long)(v * 1024ULL);
+    if (end[0] == 'G') return (unsigned long)(v * 1024ULL * 1024ULL);
+    return (unsigned long)(v / 1024ULL);
+}
+
+// Region names drivers use for device-local memory (amdgpu vram, i915 local0)
+static int fdinfo_vram_region(const char *region) {
+    return strncmp(region, "vram", 4) == 0 || strncmp(region, "local", 5) == 0;
+}
+
+// Accumulate one DRM fdinfo file (see Documentation/gpu/drm-usage-stats.rst).
+// Returns 0 if the file was counted, 1 for a duplicate of an already seen
+// client, -1 if it is not a DRM client.
+static int parse_drm_fdinfo(char *buf, unsigned long long *clients, int *nclients, ProcStat *st) {
+    int is_client = 0;
+    unsigned long long engine_ns = 0;
+    unsigned long resident_kb = 0, total_kb = 0, memory_kb = 0;
+    int have_resident = 0, have_total = 0;
+
+    char *line = buf;
+    while (*line) {
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        char *value = strchr(line, ':');
+        if (value) {
+            *value++ = '\0';
+            if (strcmp(line, "drm-client-id") == 0) {
+                unsigned long long id = strtoull(value, NULL, 10);
+                for (int i = 0; i < *nclients; i++) {
+                    if (clients[i] == id) return 1; // dup()ed fd
+                }
+                if (*nclients < PROC_DRM_MAX_CLIENTS) clients[(*nclients)++] = id;
+                is_client = 1;
+            } else if (strncmp(line, "drm-engine-", 11) == 0) {
+                if (strncmp(line + 11, "capacity-", 9) != 0) engine_ns += strtoull(value, NULL, 10);
+            } else if (strncmp(line, "drm-resident-", 13) == 0) {
+                have_resident = 1;
+                if (fdinfo_vram_region(line + 13)) resident_kb += fdinfo_kb(value);
+            } else if (strncmp(line, "drm-total-", 10) == 0) {
+                have_total = 1;
+                if (fdinfo_vram_region(line + 10)) total_kb += fdinfo_kb(value);
+            } else if (strncmp(line, "drm-memory-", 11) == 0) {
+                // Older spelling of drm-total-
+                if (fdinfo_vram_region(line + 11)) memory_kb += fdinfo_kb(value);
+            }
+        }
+        if (!nl) break;
+        line = nl + 1;
     }
-    fclose(fp);
+    if (!is_client) return -1;
 
-    // /proc/[pid]/stat: pid (comm) state ppid ...
-    // comm can contain spaces; find '(' and last ')'
-    char *l = strchr(buf, '(');
-    char *r = strrchr(buf, ')');
-    if (!l || !r || r <= l) return -1;
+    st->drm_fds++;
+    st->gpu_ns += engine_ns;
+    // Resident when the driver reports it, else the total allocated
+    st->vram_kb += have_resident ? resident_kb : (have_total ? total_kb : memory_kb);
+    return 0;
+}
 
-    // pid is before '('
-    // comm is inside
-    size_t comm_len = (size_t)(r - l - 1);
-    if (comm_len >= comm_sz) comm_len = comm_sz - 1;
-    memcpy(comm_out, l + 1, comm_len);
-    comm_out[comm_len] = '\0';
-
-    // now parse after ") "
-    char *p = r + 2;
-    char state = 0;
-    int ppid = 0;
-
-    // We need: state(3), ppid(4), utime(14), stime(15), starttime(22), vsize(23), rss(24)
-    // We'll scan sequentially.
-    // field 3 state
-    if (sscanf(p, "%c %d", &state, &ppid) != 2) return -1;
-
-    // advance p past state and ppid
-    // easiest: tokenization by spaces
-    int field = 3;
-    char *save = NULL;
-    char *tok = strtok_r(p, " ", &save);
-    // tok should be state
-    (void)tok;
-    tok = strtok_r(NULL, " ", &save);
-    // tok should be ppid
-    (void)tok;
-    field = 5;
-
-    unsigned long long utime = 0, stime = 0, starttime = 0, vsize = 0;
-    long rss_pages = 0;
-
-    while ((tok = strtok_r(NULL, " ", &save)) != NULL) {
-        // current tok is field index
-        if (field == 14) utime = strtoull(tok, NULL, 10);
-        else if (field == 15) stime = strtoull(tok, NULL, 10);
-        else if (field == 22) starttime = strtoull(tok, NULL, 10);
-        else if (field == 23) vsize = strtoull(tok, NULL, 10);
-        else if (field == 24) {
-            rss_pages = strtol(tok, NULL, 10);
-            break;
+// Find the DRM fds among /proc/<pid>/fd (by link target, no stat of the
+// device) and sum the usage their fdinfo reports.
+static void read_proc_drm(int proc_fd, int pid, ProcStat *st) {
+    char path[64];
+    int len = pid_path(path, pid, "/fd");
+    int dir_fd = openat(proc_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) return; // not ours to look at
+    DIR *dir = fdopendir(dir_fd);
+    if (!dir) {
+        close(dir_fd);
+        return;
+    }
+
+    st->drm_fds = 0;
+    unsigned long long clients[PROC_DRM_MAX_CLIENTS];
+    int nclients = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!isdigit((unsigned char)ent->d_name[0])) continue;
+
+        char target[64];
+        ssize_t n = readlinkat(dir_fd, ent->d_name, target, sizeof(target) - 1);
+        if (n <= 0) continue;
+        target[n] = '\0';
+        if (strncmp(target, "/dev/dri/", 9) != 0) continue;
+
+        // "<pid>/fd" becomes "<pid>/fdinfo/<fd>"
+        memcpy(path + len, "info/", 5);
+        snprintf(path + len + 5, sizeof(path) - (size_t)(len + 5), "%s", ent->d_name);
+        int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        char buf[4096];
+        ssize_t got = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (got <= 0) continue;
+        buf[got] = '\0';
+        parse_drm_fdinfo(buf, clients, &nclients, st);
+    }
+    closedir(dir);
+}
+
+// Workers only start once a pass has this many pids per worker;
+// below that the thread handoff costs more than it saves.
+#define PROC_SCAN_PER_WORKER 1024
+
+typedef struct {
+    struct proc_scan_pool *pool;
+    int index;
+    pthread_t thread;
+} ProcScanHelper;
+
+struct proc_scan_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    ProcSampleCtx *ctx;
+    ProcScanHelper *helpers;
+    int nhelpers;
+    unsigned int round;
+    int active;  // helpers taking part in the current round
+    int count;   // pids in the current round
+    int pending;
+    int stop;
+};
+
+// Walk the fd table of known DRM clients, new pids, and a rotating share
+// of the rest. The pid table is only read here; it changes in the merge.
+static int proc_drm_due(const ProcSampleCtx *ctx, int pid, const ProcStat *st) {
+    if (!ctx->drm_usage) return 0;
+    if ((unsigned int)pid % PROC_DRM_RESCAN_PASSES == ctx->generation % PROC_DRM_RESCAN_PASSES) return 1;
+    if (!ctx->pid_samples_cap) return 1;
+    const ProcPidSample *ps = pid_table_probe(ctx->pid_samples, ctx->pid_samples_cap, pid);
+    return ps->pid == 0 || ps->starttime != st->starttime || ps->has_drm;
+}
+
+// Read and parse the stat files for scan_pids[first, last).
+// A zero state marks a pid that went away in the meantime.
+static void proc_scan_range(ProcSampleCtx *ctx, int first, int last) {
+    for (int i = first; i < last; i++) {
+        ProcStat *st = &ctx->scan_stats[i];
+        if (read_proc_stat(ctx->proc_fd, ctx->scan_pids[i], st) != 0) {
+            st->state = 0;
+            continue;
         }
-        field++;
+        if (proc_drm_due(ctx, ctx->scan_pids[i], st)) read_proc_drm(ctx->proc_fd, ctx->scan_pids[i], st);
+    }
+}
+
+static void *proc_scan_helper(void *arg) {
+    ProcScanHelper *helper = (ProcScanHelper *)arg;
+    struct proc_scan_pool *pool = helper->pool;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->round == seen) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) break;
+        seen = pool->round;
+        if (helper->index >= pool->active) continue;
+
+        // Range 0 belongs to the calling thread
+        long parts = pool->active + 1;
+        long count = pool->count;
+        pthread_mutex_unlock(&pool->lock);
+
+        proc_scan_range(pool->ctx, (int)(count * (helper->index + 1) / parts),
+                        (int)(count * (helper->index + 2) / parts));
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void proc_scan_pool_destroy(struct proc_scan_pool *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nhelpers; i++) pthread_join(pool->helpers[i].thread, NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->helpers);
+    free(pool);
+}
+
+void proc_set_drm_usage(ProcSampleCtx *ctx, int enabled) {
+    ctx->drm_usage = enabled;
+}
+
+int proc_set_workers(ProcSampleCtx *ctx, int workers) {
+    if (!ctx) return -1;
+    if (workers < 1) workers = 1;
+    if (workers > PROC_SCAN_MAX_WORKERS) workers = PROC_SCAN_MAX_WORKERS;
+
+    proc_scan_pool_destroy(ctx->scan_pool);
+    ctx->scan_pool = NULL;
+    ctx->scan_workers = 1;
+    if (workers == 1) return 0;
+
+    struct proc_scan_pool *pool = (struct proc_scan_pool *)calloc(1, sizeof(*pool));
+    if (!pool) return -1;
+    pool->helpers = (ProcScanHelper *)calloc((size_t)(workers - 1), sizeof(ProcScanHelper));
+    if (!pool->helpers) {
+        free(pool);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->ctx = ctx;
+
+    for (int i = 0; i < workers - 1; i++) {
+        pool->helpers[i].pool = pool;
+        pool->helpers[i].index = i;
+        if (pthread_create(&pool->helpers[i].thread, NULL, proc_scan_helper, &pool->helpers[i]) != 0) break;
+        pool->nhelpers++;
     }
 
-    *state_out = state;
-    *ppid_out = ppid;
-    *utime_out = utime;
-    *stime_out = stime;
-    *starttime_out = starttime;
-    *vsize_out = vsize;
-    *rss_pages_out = rss_pages;
+    ctx->scan_pool = pool;
+    ctx->scan_workers = pool->nhelpers + 1;
+    return 0;
+}
+
+// Fill scan_stats for the first count pids, split across the worker pool
+static void proc_scan_stats(ProcSampleCtx *ctx, int count) {
+    struct proc_scan_pool *pool = ctx->scan_pool;
+    int helpers = pool ? count / PROC_SCAN_PER_WORKER : 0;
+    if (pool && helpers > pool->nhelpers) helpers = pool->nhelpers;
+
+    if (helpers == 0) {
+        proc_scan_range(ctx, 0, count);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->active = helpers;
+    pool->count = count;
+    pool->pending = helpers;
+    pool->round++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    proc_scan_range(ctx, 0, (int)((long)count / (helpers + 1)));
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int proc_scan_reserve(ProcSampleCtx *ctx, int needed) {
+    if (needed <= ctx->scan_cap) return 0;
+    int new_cap = ctx->scan_cap ? ctx->scan_cap : 1024;
+    while (new_cap < needed) new_cap *= 2;
+
+    int *pids = (int *)realloc(ctx->scan_pids, (size_t)new_cap * sizeof(int));
+    if (!pids) return -1;
+    ctx->scan_pids = pids;
+    ProcStat *stats = (ProcStat *)realloc(ctx->scan_stats, (size_t)new_cap * sizeof(ProcStat));
+    if (!stats) return -1;
+    ctx->scan_stats = stats;
+    ctx->scan_cap = new_cap;
     return 0;
 }
 
@@ -170,144 +572,298 @@ typedef enum {
     PROC_SORT_CPU = 0,
     PROC_SORT_MEM = 1,
     PROC_SORT_RSS = 2,
-    PROC_SORT_PID = 3
+    PROC_SORT_PID = 3,
+    PROC_SORT_GPU = 4,
+    PROC_SORT_VRAM = 5
 } ProcSort;
 
 static ProcSort g_sort_mode = PROC_SORT_CPU;
 
 void proc_set_sort_mode(int mode) {
-    if (mode < 0 || mode > 3) mode = 0;
+    if (mode < 0 || mode > 5) mode = 0;
     g_sort_mode = (ProcSort)mode;
 }
 
-static int cmp_cpu_desc(const void *a, const void *b) {
-    const ProcessInfo *pa = (const ProcessInfo *)a;
-    const ProcessInfo *pb = (const ProcessInfo *)b;
-    if (pa->cpu_percent < pb->cpu_percent) return 1;
-    if (pa->cpu_percent > pb->cpu_percent) return -1;
-    return (pa->pid - pb->pid);
+// Every sort mode is expressed as an ascending key (descending columns are
+// negated), ties broken by pid, so sorting never touches the columns.
+static int sort_key_cmp(const void *a, const void *b) {
+    const ProcSortKey *ka = (const ProcSortKey *)a;
+    const ProcSortKey *kb = (const ProcSortKey *)b;
+    if (ka->key < kb->key) return -1;
+    if (ka->key > kb->key) return 1;
+    return ka->pid - kb->pid;
 }
 
-static int cmp_mem_desc(const void *a, const void *b) {
-    const ProcessInfo *pa = (const ProcessInfo *)a;
-    const ProcessInfo *pb = (const ProcessInfo *)b;
-    if (pa->mem_percent < pb->mem_percent) return 1;
-    if (pa->mem_percent > pb->mem_percent) return -1;
-    return (pa->pid - pb->pid);
+static double sort_key_for(const ProcTable *table, int row, ProcSort mode) {
+    switch (mode) {
+        case PROC_SORT_MEM: return -table->mem_percent[row];
+        case PROC_SORT_RSS: return -(double)table->rss_kb[row];
+        case PROC_SORT_PID: return 0.0; // pid tie-break does the work
+        case PROC_SORT_GPU: return -table->gpu_percent[row];
+        case PROC_SORT_VRAM: return -(double)table->vram_kb[row];
+        case PROC_SORT_CPU:
+        default: return -table->cpu_percent[row];
+    }
 }
 
-static int cmp_rss_desc(const void *a, const void *b) {
-    const ProcessInfo *pa = (const ProcessInfo *)a;
-    const ProcessInfo *pb = (const ProcessInfo *)b;
-    if (pa->rss_kb < pb->rss_kb) return 1;
-    if (pa->rss_kb > pb->rss_kb) return -1;
-    return (pa->pid - pb->pid);
+// Bounded max-heap on sort order: the root is the kept key that sorts last
+static void heap_sift_up(ProcSortKey *heap, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (sort_key_cmp(&heap[i], &heap[parent]) <= 0) break;
+        ProcSortKey tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
 }
 
-static int cmp_pid_asc(const void *a, const void *b) {
-    const ProcessInfo *pa = (const ProcessInfo *)a;
-    const ProcessInfo *pb = (const ProcessInfo *)b;
-    return pa->pid - pb->pid;
+static void heap_sift_down(ProcSortKey *heap, int n, int i) {
+    for (;;) {
+        int largest = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < n && sort_key_cmp(&heap[l], &heap[largest]) > 0) largest = l;
+        if (r < n && sort_key_cmp(&heap[r], &heap[largest]) > 0) largest = r;
+        if (largest == i) break;
+        ProcSortKey tmp = heap[i];
+        heap[i] = heap[largest];
+        heap[largest] = tmp;
+        i = largest;
+    }
 }
 
-static int process_cmp(const void *a, const void *b) {
-    switch (g_sort_mode) {
-        case PROC_SORT_MEM: return cmp_mem_desc(a, b);
-        case PROC_SORT_RSS: return cmp_rss_desc(a, b);
-        case PROC_SORT_PID: return cmp_pid_asc(a, b);
-        case PROC_SORT_CPU:
-        default: return cmp_cpu_desc(a, b);
+// Reorder keys so keys[0, k) is the first k of the full order, sorted;
+// the rest are left in no particular order. Returns the sorted length.
+static int sort_keys_partial(ProcSortKey *keys, int count, int k) {
+    if (k <= 0) return 0;
+    // Selection only pays off while the window is small
+    if (k >= count / 2) {
+        qsort(keys, (size_t)count, sizeof(ProcSortKey), sort_key_cmp);
+        return count;
+    }
+
+    // keys[0, k) doubles as the heap; losers are swapped out behind it
+    for (int i = 0; i < k; i++) heap_sift_up(keys, i);
+    for (int i = k; i < count; i++) {
+        if (sort_key_cmp(&keys[i], &keys[0]) < 0) {
+            ProcSortKey tmp = keys[0];
+            keys[0] = keys[i];
+            keys[i] = tmp;
+            heap_sift_down(keys, k, 0);
+        }
     }
+    qsort(keys, (size_t)k, sizeof(ProcSortKey), sort_key_cmp);
+    return k;
 }
 
-int proc_list(ProcessInfo **out, int *out_count, ProcSampleCtx *ctx, const char *name_filter) {
-    if (!out || !out_count || !ctx) return -1;
+// Key a table filled elsewhere (e.g. copied from the daemon) for the
+// current sort mode and sort its first sort_limit rows
+void proc_table_resort(ProcTable *table, int sort_limit) {
+    for (int row = 0; row < table->count; row++) {
+        table->keys[row].key = sort_key_for(table, row, g_sort_mode);
+        table->keys[row].pid = table->pid[row];
+        table->keys[row].row = row;
+    }
+    table->sorted = 0;
+    proc_sort_more(table, sort_limit);
+}
 
-    DIR *dir = opendir("/proc");
-    if (!dir) return -1;
+// Extend the sorted prefix of table->order to at least limit rows. Only
+// keys and order entries past the current prefix are written, so readers
+// of order[0, sorted) are not disturbed.
+int proc_sort_more(ProcTable *table, int limit) {
+    int sorted = table->sorted;
+    int count = table->count;
+    if (sorted >= count) return count;
+    if (limit <= 0 || limit > count) limit = count;
+    if (limit <= sorted) return sorted;
+
+    int n = sort_keys_partial(table->keys + sorted, count - sorted, limit - sorted);
+    for (int i = sorted; i < sorted + n; i++) table->order[i] = table->keys[i].row;
+    table->sorted = sorted + n;
+    return table->sorted;
+}
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+// All columns live in one block, carved up below
+ProcTable *proc_table_alloc(int cap) {
+    if (cap < 1) cap = 1;
+    size_t n = (size_t)cap;
+    size_t sizes[] = {
+        n * sizeof(int), n * sizeof(char), n * sizeof(int), n * sizeof(double), n * sizeof(double),
+        n * sizeof(unsigned long), n * sizeof(int), n * sizeof(int), n * sizeof(int), n * sizeof(int),
+        n * sizeof(unsigned long), n * sizeof(unsigned long), n * sizeof(double), n * sizeof(unsigned long),
+        n * PROC_COMM_LEN,
+        n * sizeof(ProcSortKey), n * sizeof(int)
+    };
+    size_t total = align8(sizeof(ProcTable));
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) total += align8(sizes[i]);
+
+    char *block = (char *)malloc(total);
+    if (!block) return NULL;
+
+    ProcTable *table = (ProcTable *)block;
+    memset(table, 0, sizeof(*table));
+    char *p = block + align8(sizeof(ProcTable));
+    void **columns[] = {
+        (void **)&table->pid, (void **)&table->state, (void **)&table->ppid,
+        (void **)&table->cpu_percent, (void **)&table->mem_percent, (void **)&table->rss_kb,
+        (void **)&table->num_threads, (void **)&table->priority, (void **)&table->nice,
+        (void **)&table->processor, (void **)&table->minflt, (void **)&table->majflt,
+        (void **)&table->gpu_percent, (void **)&table->vram_kb, (void **)&table->comm, (void **)&table->keys, (void **)&table->order
+    };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        *columns[i] = p;
+        p += align8(sizes[i]);
+    }
+    table->cap = cap;
+    table->refs = 1;
+    return table;
+}
+
+void proc_table_unref(ProcTable *table) {
+    if (!table || --table->refs > 0) return;
+    free(table);
+}
 
-    unsigned long long total_jiffies_now = read_total_jiffies();
+int proc_list(ProcTable **out, ProcSampleCtx *ctx, const SysStat *stat, const char *name_filter, int sort_limit) {
+    if (!out || !ctx || !stat) return -1;
+
+    if (proc_dir_rewind(ctx) != 0) return -1;
+
+    unsigned long long total_jiffies_now = stat->valid ? cpu_times_total(&stat->total) : 0;
     unsigned long long total_delta = 0;
     if (ctx->last_total_jiffies && total_jiffies_now > ctx->last_total_jiffies)
         total_delta = total_jiffies_now - ctx->last_total_jiffies;
     ctx->last_total_jiffies = total_jiffies_now;
 
-    int cap = 256;
-    int count = 0;
-    ProcessInfo *list = (ProcessInfo *)calloc((size_t)cap, sizeof(ProcessInfo));
-    if (!list) {
-        closedir(dir);
-        return -1;
-    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long long now_ns = (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+    unsigned long long wall_delta_ns = ctx->last_pass_ns ? now_ns - ctx->last_pass_ns : 0;
+    ctx->last_pass_ns = now_ns;
 
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
+    // Every pid seen in this pass is stamped with the new generation
+    ctx->generation++;
+    if (ctx->generation == 0) ctx->generation = 1;
+
+    // List the pids first so the stat reads can be split across workers
+    int npids = 0;
+    struct linux_dirent64 *ent;
+    while ((ent = proc_dir_next(ctx)) != NULL) {
         if (!isdigit((unsigned char)ent->d_name[0])) continue;
         int pid = atoi(ent->d_name);
         if (pid <= 0) continue;
+        if (proc_scan_reserve(ctx, npids + 1) != 0) break;
+        ctx->scan_pids[npids++] = pid;
+    }
 
-        ProcessInfo info;
-        memset(&info, 0, sizeof(info));
-        info.pid = pid;
-
-        unsigned long long utime = 0, stime = 0, starttime = 0, vsize = 0;
-        long rss_pages = 0;
-        if (read_proc_stat(pid, info.comm, sizeof(info.comm), &info.state, &info.ppid,
-                           &utime, &stime, &starttime, &vsize, &rss_pages) != 0) {
-            continue;
-        }
-
-        if (!name_matches_filter(info.comm, name_filter)) continue;
+    ProcTable *table = proc_table_alloc(npids);
+    if (!table) return -1;
 
-        unsigned long rss_kb = 0;
-        if (rss_pages > 0 && ctx->page_size > 0) {
-            rss_kb = (unsigned long)((unsigned long long)rss_pages * (unsigned long long)ctx->page_size / 1024ULL);
-        }
-        info.rss_kb = rss_kb;
+    proc_scan_stats(ctx, npids);
 
-        if (ctx->mem_total_kb > 0) info.mem_percent = 100.0 * ((double)rss_kb / (double)ctx->mem_total_kb);
+    // Merge the worker results in listing order
+    int count = 0;
+    for (int i = 0; i < npids; i++) {
+        const ProcStat *st = &ctx->scan_stats[i];
+        if (!st->state) continue;
+        int pid = ctx->scan_pids[i];
 
         // CPU% using per-pid deltas vs total jiffies delta. This yields ~0..100*cores on multi-core systems.
-        unsigned long long proc_time_now = utime + stime;
-        ProcPidSample *ps = find_or_create_pid_sample(ctx, pid);
+        // Sampled before filtering so hidden processes keep their history.
+        unsigned long long proc_time_now = st->utime + st->stime;
+        ProcPidSample *ps = find_or_create_pid_sample(ctx, pid, st->starttime);
         unsigned long long proc_delta = 0;
         if (ps) {
             if (ps->last_proc_time && proc_time_now >= ps->last_proc_time) proc_delta = proc_time_now - ps->last_proc_time;
             ps->last_proc_time = proc_time_now;
         }
 
-        if (total_delta > 0) info.cpu_percent = 100.0 * ((double)proc_delta / (double)total_delta);
-        else info.cpu_percent = 0.0;
+        // GPU% from the engine busy time, relative to wall time
+        double gpu_percent = 0.0;
+        if (ps && st->drm_fds >= 0) {
+            ps->has_drm = st->drm_fds > 0;
+            if (ps->last_gpu_ns && st->gpu_ns >= ps->last_gpu_ns && wall_delta_ns > 0)
+                gpu_percent = 100.0 * (double)(st->gpu_ns - ps->last_gpu_ns) / (double)wall_delta_ns;
+            if (gpu_percent > 100.0) gpu_percent = 100.0;
+            ps->last_gpu_ns = st->gpu_ns;
+        }
+
+        if (!proc_name_matches(st->comm, name_filter)) continue;
 
-        if (count >= cap) {
-            cap *= 2;
-            ProcessInfo *tmp = (ProcessInfo *)realloc(list, (size_t)cap * sizeof(ProcessInfo));
-            if (!tmp) break;
-            list = tmp;
+        unsigned long rss_kb = 0;
+        if (st->rss_pages > 0 && ctx->page_size > 0) {
+            rss_kb = (unsigned long)((unsigned long long)st->rss_pages * (unsigned long long)ctx->page_size / 1024ULL);
         }
-        list[count++] = info;
+
+        int row = count++;
+        table->pid[row] = pid;
+        memcpy(table->comm[row], st->comm, PROC_COMM_LEN);
+        table->state[row] = st->state;
+        table->ppid[row] = st->ppid;
+        table->rss_kb[row] = rss_kb;
+        table->mem_percent[row] = ctx->mem_total_kb > 0 ? 100.0 * ((double)rss_kb / (double)ctx->mem_total_kb) : 0.0;
+        table->cpu_percent[row] = total_delta > 0 ? 100.0 * ((double)proc_delta / (double)total_delta) : 0.0;
+        table->num_threads[row] = st->num_threads;
+        table->priority[row] = st->priority;
+        table->nice[row] = st->nice;
+        table->processor[row] = st->processor;
+        table->minflt[row] = st->minflt;
+        table->majflt[row] = st->majflt;
+        table->gpu_percent[row] = gpu_percent;
+        table->vram_kb[row] = st->drm_fds > 0 ? st->vram_kb : 0;
+
+        table->keys[row].key = sort_key_for(table, row, g_sort_mode);
+        table->keys[row].pid = pid;
+        table->keys[row].row = row;
     }
+    table->count = count;
 
-    closedir(dir);
+    pid_table_evict_stale(ctx);
 
-    // use current mode when sorting
-    qsort(list, (size_t)count, sizeof(ProcessInfo), process_cmp);
+    // use current mode when sorting; only the first sort_limit rows if asked
+    proc_sort_more(table, sort_limit);
 
-    *out = list;
-    *out_count = count;
+    *out = table;
     return 0;
 }
 
-void proc_free(ProcessInfo *list) {
-    free(list);
-}
-
 void proc_free_ctx(ProcSampleCtx *ctx) {
     if (!ctx) return;
+    proc_scan_pool_destroy(ctx->scan_pool);
+    ctx->scan_pool = NULL;
+    free(ctx->scan_pids);
+    free(ctx->scan_stats);
+    ctx->scan_pids = NULL;
+    ctx->scan_stats = NULL;
+    ctx->scan_cap = 0;
+
     free(ctx->pid_samples);
     ctx->pid_samples = NULL;
     ctx->pid_samples_count = 0;
     ctx->pid_samples_cap = 0;
+
+    if (ctx->proc_fd >= 0) close(ctx->proc_fd);
+    ctx->proc_fd = -1;
+    free(ctx->dents_buf);
+    ctx->dents_buf = NULL;
+}
+
+int proc_count(void) {
+    DIR *dir = opendir("/proc");
+    if (!dir) return -1;
+    int count = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (isdigit((unsigned char)ent->d_name[0])) count++;
+    }
+    closedir(dir);
+    return count;
 }
 
 int proc_kill(int pid, int sig) {
@@ -315,3 +871,76 @@ int proc_kill(int pid, int sig) {
     if (kill(pid, sig) != 0) return -1;
     return 0;
 }
+
+// Time proc_list against the size of the process table and the worker count.
+// Idle children are forked to grow the table in steps up to max_procs extra.
+int proc_bench_scan(int max_procs, int max_workers) {
+    const int passes = 5;
+    ProcSampleCtx ctx;
+    if (proc_init_ctx(&ctx) != 0) {
+        perror("Failed to open /proc");
+        return -1;
+    }
+    if (max_workers < 1) max_workers = 1;
+
+    // One /proc/stat sample is enough; only the scan is timed
+    SysStat stat = {0};
+    sysstat_read(&stat);
+
+    pid_t *children = (pid_t *)calloc((size_t)(max_procs > 0 ? max_procs : 1), sizeof(pid_t));
+    if (!children) {
+        sysstat_free(&stat);
+        proc_free_ctx(&ctx);
+        return -1;
+    }
+    int nchildren = 0;
+
+    printf("%8s", "procs");
+    for (int w = 1; w <= max_workers; w *= 2) printf("  %6d thr", w);
+    printf("   (ms per scan, mean of %d)\n", passes);
+
+    for (int target = 0;; target = target ? target * 2 : 1000) {
+        if (target > max_procs) target = max_procs;
+        while (nchildren < target) {
+            pid_t child = fork();
+            if (child < 0) break;
+            if (child == 0) {
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                pause();
+                _exit(0);
+            }
+            children[nchildren++] = child;
+        }
+
+        int count = 0;
+        ProcTable *table = NULL;
+        for (int w = 1; w <= max_workers; w *= 2) {
+            proc_set_workers(&ctx, w);
+            if (proc_list(&table, &ctx, &stat, NULL, 0) == 0) proc_table_unref(table); // warm up
+
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (int i = 0; i < passes; i++) {
+                if (proc_list(&table, &ctx, &stat, NULL, 0) == 0) {
+                    count = table->count;
+                    proc_table_unref(table);
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            double ms = ((t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_nsec - t0.tv_nsec) / 1000000.0) / passes;
+            if (w == 1) printf("%8d", count);
+            printf("  %10.2f", ms);
+        }
+        printf("\n");
+        fflush(stdout);
+
+        if (target >= max_procs || nchildren < target) break;
+    }
+
+    for (int i = 0; i < nchildren; i++) kill(children[i], SIGKILL);
+    for (int i = 0; i < nchildren; i++) waitpid(children[i], NULL, 0);
+    free(children);
+    sysstat_free(&stat);
+    proc_free_ctx(&ctx);
+    return 0;
+}
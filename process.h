@@ -3,36 +3,130 @@
 
 #include <stddef.h>
 
+#include "sysstat.h"
+
+#define PROC_SCAN_MAX_WORKERS 64
+#define PROC_COMM_LEN 64
+
 typedef struct {
+    double key; // ascending; descending columns are stored negated
     int pid;
-    char comm[64];
+    int row;
+} ProcSortKey;
+
+// Process snapshot stored column-wise; rows are addressed by index and
+// shown in the order given by order[]. Sorting only moves the compact keys.
+//
+// A table can back several UI snapshots: when the view scrolls past the
+// sorted rows, the stats thread sorts further into keys/order past
+// `sorted` in place and republishes it. Readers must only use
+// order[0, sorted) as it was when they got the table. refs is only
+// touched by the stats thread.
+typedef struct {
+    int count;
+    int cap;
+    int *pid;
+    char *state;
+    int *ppid;
+    double *cpu_percent;
+    double *mem_percent;
+    unsigned long *rss_kb;
+    int *num_threads;
+    int *priority;
+    int *nice;
+    int *processor; // CPU it last ran on
+    unsigned long *minflt;
+    unsigned long *majflt;
+    double *gpu_percent; // busy time over all DRM engines, 0 without a DRM fd
+    unsigned long *vram_kb;
+    char (*comm)[PROC_COMM_LEN];
+
+    ProcSortKey *keys;
+    int *order;
+    int sorted; // order[0, sorted) is final
+    int refs;
+} ProcTable;
+
+// Fields of interest from one /proc/[pid]/stat line
+typedef struct {
+    char comm[PROC_COMM_LEN];
     char state;
     int ppid;
-    double cpu_percent;
-    double mem_percent;
-    unsigned long rss_kb;
-} ProcessInfo;
+    unsigned long minflt;
+    unsigned long majflt;
+    unsigned long long utime;
+    unsigned long long stime;
+    int priority;
+    int nice;
+    int num_threads;
+    unsigned long long starttime;
+    unsigned long long vsize;
+    long rss_pages;
+    int processor;
+    // Summed over the process' DRM clients (fdinfo); drm_fds < 0 when the
+    // fd table was not walked this pass
+    int drm_fds;
+    unsigned long long gpu_ns;
+    unsigned long vram_kb;
+} ProcStat;
 
 typedef struct {
-    int pid;
+    int pid; // 0 marks an empty slot
+    unsigned long long starttime; // tells a reused pid apart from the old process
     unsigned long long last_proc_time;
+    unsigned long long last_gpu_ns;
+    unsigned int generation; // last proc_list pass that saw this pid
+    int has_drm; // held a DRM fd when its fd table was last walked
 } ProcPidSample;
 
 typedef struct {
     long page_size;
     unsigned long mem_total_kb;
     unsigned long long last_total_jiffies;
+    unsigned long long last_pass_ns; // CLOCK_MONOTONIC, for GPU%
+
+    // Walk fd tables for DRM clients (per-process GPU% and VRAM)
+    int drm_usage;
 
+    // Open-addressing hash table keyed by pid (linear probing,
+    // power-of-two capacity, kept at most half full)
     ProcPidSample *pid_samples;
     int pid_samples_count;
     int pid_samples_cap;
+    unsigned int generation;
+
+    // /proc stays open between passes; entries are read with getdents64
+    int proc_fd;
+    char *dents_buf;
+    int dents_len;
+    int dents_pos;
+
+    // Pids listed in the current pass and their parsed stat lines.
+    // Workers fill disjoint ranges; the merge runs on the calling thread.
+    int *scan_pids;
+    ProcStat *scan_stats;
+    int scan_cap;
+    int scan_workers;
+    struct proc_scan_pool *scan_pool;
 } ProcSampleCtx;
 
 int proc_init_ctx(ProcSampleCtx *ctx);
-int proc_list(ProcessInfo **out, int *out_count, ProcSampleCtx *ctx, const char *name_filter);
-void proc_free(ProcessInfo *list);
+// sort_limit > 0 only guarantees order for the first sort_limit rows
+// stat is this tick's /proc/stat sample; CPU% is relative to its total.
+int proc_list(ProcTable **out, ProcSampleCtx *ctx, const SysStat *stat, const char *name_filter, int sort_limit);
+int proc_sort_more(ProcTable *table, int limit);
+void proc_table_resort(ProcTable *table, int sort_limit);
+// Case-insensitive substring match; an empty filter matches everything
+int proc_name_matches(const char *comm, const char *filter);
+void proc_set_drm_usage(ProcSampleCtx *ctx, int enabled);
+ProcTable *proc_table_alloc(int cap);
+void proc_table_unref(ProcTable *table);
 int proc_kill(int pid, int sig);
+// Processes in /proc right now, -1 if it cannot be read
+int proc_count(void);
 void proc_free_ctx(ProcSampleCtx *ctx);
 void proc_set_sort_mode(int mode);
+int proc_set_workers(ProcSampleCtx *ctx, int workers);
+int proc_bench_scan(int max_procs, int max_workers);
 
 #endif
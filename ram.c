@@ -1,27 +1,30 @@
 #include "modules.h"
+#include "counter.h"
+
+static CounterSource meminfo_src = COUNTER_SOURCE_INIT("/proc/meminfo");
 
 float mem_perc() {
-  FILE *meminfo = fopen("/proc/meminfo", "r");
+    const char *meminfo = counter_read(&meminfo_src, NULL);
     if (meminfo == NULL) {
-        perror("Error opening /proc/meminfo");
         return -1;
     }
 
-    char line[256];
     unsigned long total_mem = 0;
     unsigned long available_mem = 0;
 
-    while (fgets(line, sizeof(line), meminfo)) {
+    const char *line = meminfo;
+    while (line && *line) {
         if (strncmp(line, "MemTotal:", 9) == 0) {
             sscanf(line, "MemTotal: %lu kB", &total_mem);
         }
-        if (strncmp(line, "MemAvailable:", 12) == 0) {
+        if (strncmp(line, "MemAvailable:", 13) == 0) {
             sscanf(line, "MemAvailable: %lu kB", &available_mem);
+            break;
         }
+        line = strchr(line, '\n');
+        if (line) line++;
     }
 
-    fclose(meminfo);
-
     if (total_mem == 0) {
         return -1;
     }
@@ -0,0 +1,667 @@
+#include "record.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define REC_FRAME 0x4d524656 // "VFRM"
+#define REC_INDEX 0x58444956 // "VIDX"
+// Anything larger is garbage, not a record
+#define REC_MAX_RECORD (64u << 20)
+
+typedef struct {
+  uint32_t kind;
+  uint32_t size; // payload bytes
+  int64_t time_ns;
+} RecHead;
+
+typedef struct {
+  uint32_t size;
+  uint32_t kind;
+} RecTail;
+
+typedef struct {
+  const unsigned char *p;
+  const unsigned char *end;
+} RecCursor;
+
+static void buf_put(RecBuf *buf, const void *data, size_t len) {
+  if (buf->len + len > buf->cap) {
+    size_t cap = buf->cap ? buf->cap : 65536;
+    while (cap < buf->len + len) cap *= 2;
+    unsigned char *grown = (unsigned char *)realloc(buf->data, cap);
+    if (!grown) {
+      buf->failed = 1;
+      return;
+    }
+    buf->data = grown;
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+// Length-prefixed, without the terminator
+static void buf_put_str(RecBuf *buf, const char *s, size_t max) {
+  size_t len = strnlen(s, max);
+  if (len > 255) len = 255;
+  unsigned char n = (unsigned char)len;
+  buf_put(buf, &n, 1);
+  buf_put(buf, s, len);
+}
+
+static int rec_get(RecCursor *c, void *out, size_t len) {
+  if ((size_t)(c->end - c->p) < len) return -1;
+  memcpy(out, c->p, len);
+  c->p += len;
+  return 0;
+}
+
+static int rec_get_str(RecCursor *c, char *out, size_t size) {
+  unsigned char n;
+  if (rec_get(c, &n, 1) != 0 || (size_t)(c->end - c->p) < n) return -1;
+  size_t keep = n < size ? n : size - 1;
+  memcpy(out, c->p, keep);
+  out[keep] = '\0';
+  c->p += n;
+  return 0;
+}
+
+static int rec_pread(int fd, void *out, size_t len, uint64_t off) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, (char *)out + done, len - done, (off_t)(off + done));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    done += (size_t)n;
+  }
+  return 0;
+}
+
+static int rec_pwrite(int fd, const void *data, size_t len, uint64_t off) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pwrite(fd, (const char *)data + done, len - done, (off_t)(off + done));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    done += (size_t)n;
+  }
+  return 0;
+}
+
+static void rec_header_init(RecFileHeader *h, int interval_ms, int core_count, int has_gpu) {
+  memset(h, 0, sizeof(*h));
+  h->magic = REC_MAGIC;
+  h->version = REC_VERSION;
+  h->series_count = SERIES_COUNT;
+  h->title_len = TITLE_LEN;
+  h->disk_info_size = sizeof(DiskInfo);
+  h->interval_ms = interval_ms;
+  h->core_count = core_count;
+  h->has_gpu = has_gpu;
+}
+
+static int rec_header_ok(const RecFileHeader *h) {
+  return h->magic == REC_MAGIC && h->version == REC_VERSION && h->series_count == SERIES_COUNT &&
+         h->title_len == TITLE_LEN && h->disk_info_size == sizeof(DiskInfo) && h->interval_ms > 0;
+}
+
+// The record at off, if its head and tail agree and it ends by limit
+static int rec_head_at(int fd, uint64_t off, uint64_t limit, RecHead *head) {
+  RecTail tail;
+  if (off + sizeof(RecHead) + sizeof(RecTail) > limit || rec_pread(fd, head, sizeof(*head), off) != 0) return -1;
+  if ((head->kind != REC_FRAME && head->kind != REC_INDEX) || head->size > REC_MAX_RECORD) return -1;
+  uint64_t tail_off = off + sizeof(RecHead) + head->size;
+  if (tail_off + sizeof(RecTail) > limit || rec_pread(fd, &tail, sizeof(tail), tail_off) != 0) return -1;
+  return tail.size == head->size && tail.kind == head->kind ? 0 : -1;
+}
+
+static uint64_t rec_next(uint64_t off, const RecHead *head) {
+  return off + sizeof(RecHead) + head->size + sizeof(RecTail);
+}
+
+typedef struct {
+  RecIndexEntry *frames;
+  long count;
+  long cap;
+  long indexed;        // frames [0, indexed) are listed in index records
+  uint64_t end;        // end of the last intact record
+  uint64_t last_index; // 0 if there is none
+} RecIndex;
+
+static int index_push(RecIndex *index, int64_t time_ns, uint64_t offset) {
+  if (index->count == index->cap) {
+    long cap = index->cap ? index->cap * 2 : 1024;
+    RecIndexEntry *grown = (RecIndexEntry *)realloc(index->frames, (size_t)cap * sizeof(*grown));
+    if (!grown) return -1;
+    index->frames = grown;
+    index->cap = cap;
+  }
+  index->frames[index->count++] = (RecIndexEntry){time_ns, offset};
+  return 0;
+}
+
+// Slow path for a file whose end is torn (the recorder was killed mid
+// write or the machine went down): walk every record from the start and
+// stop at the first one that is not intact.
+static int index_scan_forward(int fd, uint64_t size, RecIndex *index) {
+  index->count = index->indexed = 0;
+  index->last_index = 0;
+  uint64_t off = sizeof(RecFileHeader);
+  RecHead head;
+  while (rec_head_at(fd, off, size, &head) == 0) {
+    if (head.kind == REC_INDEX) {
+      index->last_index = off;
+      index->indexed = index->count;
+    } else if (index_push(index, head.time_ns, off) != 0) {
+      return -1;
+    }
+    off = rec_next(off, &head);
+  }
+  index->end = off;
+  return 0;
+}
+
+// An index record starts with the previous one's offset and its entry count
+static int index_link(int fd, uint64_t at, uint64_t *prev, uint32_t *n) {
+  unsigned char raw[sizeof(*prev) + sizeof(*n)];
+  if (rec_pread(fd, raw, sizeof(raw), at + sizeof(RecHead)) != 0) return -1;
+  memcpy(prev, raw, sizeof(*prev));
+  memcpy(n, raw + sizeof(*prev), sizeof(*n));
+  return 0;
+}
+
+// Walk back from the end to the latest index record, then follow the
+// chain of index records to the start. Only frames written after the
+// last index record are visited one by one.
+static int index_load(int fd, uint64_t size, RecIndex *index) {
+  memset(index, 0, sizeof(*index));
+  uint64_t off = size;
+  RecIndex tail = {0};
+  while (off > sizeof(RecFileHeader)) {
+    RecTail t;
+    RecHead head;
+    if (off < sizeof(RecFileHeader) + sizeof(RecHead) + sizeof(RecTail) ||
+        rec_pread(fd, &t, sizeof(t), off - sizeof(t)) != 0 || t.size > REC_MAX_RECORD ||
+        off - sizeof(RecFileHeader) < sizeof(RecHead) + t.size + sizeof(RecTail)) {
+      free(tail.frames);
+      return index_scan_forward(fd, size, index);
+    }
+    uint64_t start = off - sizeof(RecTail) - t.size - sizeof(RecHead);
+    if (rec_head_at(fd, start, off, &head) != 0) {
+      free(tail.frames);
+      return index_scan_forward(fd, size, index);
+    }
+    if (head.kind == REC_INDEX) {
+      index->last_index = start;
+      break;
+    }
+    if (index_push(&tail, head.time_ns, start) != 0) {
+      free(tail.frames);
+      return -1;
+    }
+    off = start;
+  }
+
+  // Two passes over the chain: count, then fill back to front
+  long total = 0;
+  for (uint64_t at = index->last_index; at; ) {
+    uint64_t prev;
+    uint32_t n;
+    if (index_link(fd, at, &prev, &n) != 0 || n > REC_INDEX_EVERY || prev >= at) {
+      free(tail.frames);
+      return index_scan_forward(fd, size, index);
+    }
+    total += n;
+    at = prev;
+  }
+  index->cap = total + tail.count;
+  index->frames = (RecIndexEntry *)malloc((size_t)(index->cap ? index->cap : 1) * sizeof(RecIndexEntry));
+  if (!index->frames) {
+    free(tail.frames);
+    return -1;
+  }
+  long pos = total;
+  for (uint64_t at = index->last_index; at; ) {
+    uint64_t prev;
+    uint32_t n;
+    // The chain was checked above, but the file may have changed since
+    if (index_link(fd, at, &prev, &n) != 0 || n > pos || prev >= at ||
+        rec_pread(fd, index->frames + pos - n, n * sizeof(RecIndexEntry), at + sizeof(RecHead) + sizeof(prev) + sizeof(n)) != 0) {
+      free(tail.frames);
+      return index_scan_forward(fd, size, index);
+    }
+    pos -= n;
+    at = prev;
+  }
+  index->count = index->indexed = total;
+  for (long i = tail.count - 1; i >= 0; i--) index->frames[index->count++] = tail.frames[i];
+  free(tail.frames);
+  index->end = size;
+  return 0;
+}
+
+// Finish the record in buf: its payload follows a placeholder head
+static int rec_seal(RecBuf *buf, uint32_t kind, int64_t time_ns) {
+  if (buf->failed) {
+    errno = ENOMEM;
+    return -1;
+  }
+  RecHead *head = (RecHead *)buf->data;
+  head->kind = kind;
+  head->size = (uint32_t)(buf->len - sizeof(RecHead));
+  head->time_ns = time_ns;
+  RecTail tail = {head->size, kind};
+  buf_put(buf, &tail, sizeof(tail));
+  if (buf->failed) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+static int rec_put(Recorder *rec, const void *data, size_t len) {
+  if (rec_pwrite(rec->fd, data, len, rec->end) != 0) return -1;
+  rec->end += len;
+  return 0;
+}
+
+static int rec_write_index(Recorder *rec) {
+  RecHead head = {0};
+  uint64_t prev = rec->last_index;
+  uint32_t n = (uint32_t)rec->pending_count;
+  rec->buf.len = 0;
+  rec->buf.failed = 0;
+  buf_put(&rec->buf, &head, sizeof(head));
+  buf_put(&rec->buf, &prev, sizeof(prev));
+  buf_put(&rec->buf, &n, sizeof(n));
+  buf_put(&rec->buf, rec->pending, n * sizeof(RecIndexEntry));
+  uint64_t at = rec->end;
+  int64_t time_ns = n ? rec->pending[n - 1].time_ns : 0;
+  if (rec_seal(&rec->buf, REC_INDEX, time_ns) != 0 || rec_put(rec, rec->buf.data, rec->buf.len) != 0) return -1;
+  rec->last_index = at;
+  rec->pending_count = 0;
+  return 0;
+}
+
+int rec_create(Recorder *rec, const char *path, int interval_ms, int core_count, int has_gpu) {
+  memset(rec, 0, sizeof(*rec));
+  rec->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (rec->fd < 0) return -1;
+  if (flock(rec->fd, LOCK_EX | LOCK_NB) != 0) {
+    close(rec->fd);
+    rec->fd = -1;
+    errno = EBUSY;
+    return -1;
+  }
+
+  int err = 0;
+  struct stat st;
+  RecFileHeader header;
+  rec_header_init(&header, interval_ms, core_count, has_gpu);
+  if (fstat(rec->fd, &st) != 0) {
+    err = errno;
+  } else if (st.st_size == 0) {
+    if (rec_pwrite(rec->fd, &header, sizeof(header), 0) != 0) err = errno ? errno : EIO;
+    rec->end = sizeof(header);
+  } else {
+    // Continue an earlier recording: drop a torn tail, then keep indexing
+    // where it left off
+    RecFileHeader found;
+    RecIndex index;
+    // Frames are paced and drawn by the header, so they have to match it
+    if (rec_pread(rec->fd, &found, sizeof(found), 0) != 0 || !rec_header_ok(&found) ||
+        found.interval_ms != header.interval_ms || found.core_count != header.core_count ||
+        found.has_gpu != header.has_gpu) {
+      err = EPROTO;
+    } else if (index_load(rec->fd, (uint64_t)st.st_size, &index) != 0) {
+      err = ENOMEM;
+    } else {
+      rec->end = index.end;
+      rec->last_index = index.last_index;
+      if (ftruncate(rec->fd, (off_t)rec->end) != 0) err = errno;
+      for (long i = index.indexed; i < index.count && !err; i++) {
+        rec->pending[rec->pending_count++] = index.frames[i];
+        if (rec->pending_count == REC_INDEX_EVERY && rec_write_index(rec) != 0) err = errno ? errno : EIO;
+      }
+      free(index.frames);
+    }
+  }
+  if (err) {
+    rec_close(rec);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+// Append an encoded frame record
+static int rec_add_frame(Recorder *rec, const void *data, size_t len, int64_t time_ns) {
+  uint64_t at = rec->end;
+  if (rec_put(rec, data, len) != 0) return -1;
+  rec->pending[rec->pending_count++] = (RecIndexEntry){time_ns, at};
+  if (rec->pending_count == REC_INDEX_EVERY) return rec_write_index(rec);
+  return 0;
+}
+
+static int frame_encode(RecBuf *buf, int64_t time_ns, const ShmSample *sample, const ShmStateHead *state, const ProcTable *procs) {
+  RecHead head = {0};
+  buf->len = 0;
+  buf->failed = 0;
+  buf_put(buf, &head, sizeof(head));
+
+  // Series: which ids were sampled, their values, then the core column.
+  // Its length comes first so seeking can skip the rest.
+  uint32_t series_len = 0;
+  size_t series_at = buf->len;
+  buf_put(buf, &series_len, sizeof(series_len));
+  unsigned char present[(SERIES_COUNT + 7) / 8] = {0};
+  for (int i = 0; i < SERIES_COUNT; i++) {
+    if (sample->values[i] != SHM_NO_SAMPLE) present[i / 8] |= (unsigned char)(1u << (i % 8));
+  }
+  buf_put(buf, present, sizeof(present));
+  for (int i = 0; i < SERIES_COUNT; i++) {
+    if (sample->values[i] == SHM_NO_SAMPLE) continue;
+    int64_t value = sample->values[i];
+    buf_put(buf, &value, sizeof(value));
+  }
+  uint16_t core_rows = (uint16_t)sample->core_rows;
+  buf_put(buf, &core_rows, sizeof(core_rows));
+  buf_put(buf, sample->cores, core_rows);
+  series_len = (uint32_t)(buf->len - series_at - sizeof(series_len));
+  if (!buf->failed) memcpy(buf->data + series_at, &series_len, sizeof(series_len));
+
+  // State: titles that are set, GPU count and the disks
+  buf_put_str(buf, state->cores_title, TITLE_LEN);
+  uint16_t titles = 0;
+  for (int i = 0; i < SERIES_COUNT; i++) titles += state->titles[i][0] != '\0';
+  buf_put(buf, &titles, sizeof(titles));
+  for (uint16_t i = 0; i < SERIES_COUNT; i++) {
+    if (!state->titles[i][0]) continue;
+    buf_put(buf, &i, sizeof(i));
+    buf_put_str(buf, state->titles[i], TITLE_LEN);
+  }
+  unsigned char counts[2] = {(unsigned char)state->gpu_count, (unsigned char)state->disk_count};
+  buf_put(buf, counts, sizeof(counts));
+  buf_put(buf, state->disks, (size_t)state->disk_count * sizeof(DiskInfo));
+
+  // Process rows in collection order
+  uint32_t count = procs ? (uint32_t)procs->count : 0;
+  buf_put(buf, &count, sizeof(count));
+  for (uint32_t r = 0; r < count; r++) {
+    int32_t ints[7] = {procs->pid[r], procs->ppid[r], procs->num_threads[r], procs->priority[r],
+                       procs->nice[r], procs->processor[r], procs->state[r]};
+    float floats[3] = {(float)procs->cpu_percent[r], (float)procs->mem_percent[r], (float)procs->gpu_percent[r]};
+    uint64_t longs[4] = {procs->rss_kb[r], procs->minflt[r], procs->majflt[r], procs->vram_kb[r]};
+    buf_put(buf, ints, sizeof(ints));
+    buf_put(buf, floats, sizeof(floats));
+    buf_put(buf, longs, sizeof(longs));
+    buf_put_str(buf, procs->comm[r], PROC_COMM_LEN);
+  }
+
+  return rec_seal(buf, REC_FRAME, time_ns);
+}
+
+int rec_write(Recorder *rec, int64_t time_ns, const ShmSample *sample, const ShmStateHead *state, const ProcTable *procs) {
+  if (frame_encode(&rec->buf, time_ns, sample, state, procs) != 0) return -1;
+  return rec_add_frame(rec, rec->buf.data, rec->buf.len, time_ns);
+}
+
+void rec_close(Recorder *rec) {
+  // Index the last frames too, so the next open does not walk them
+  if (rec->fd >= 0 && rec->pending_count > 0) rec_write_index(rec);
+  if (rec->fd >= 0) close(rec->fd);
+  free(rec->buf.data);
+  memset(&rec->buf, 0, sizeof(rec->buf));
+  rec->fd = -1;
+}
+
+int replay_open(Replay *replay, const char *path) {
+  memset(replay, 0, sizeof(*replay));
+  replay->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (replay->fd < 0) return -1;
+
+  int err = 0;
+  struct stat st;
+  RecIndex index;
+  if (fstat(replay->fd, &st) != 0) {
+    err = errno;
+  } else if (rec_pread(replay->fd, &replay->header, sizeof(replay->header), 0) != 0 || !rec_header_ok(&replay->header)) {
+    err = EPROTO;
+  } else if (index_load(replay->fd, (uint64_t)st.st_size, &index) != 0) {
+    err = ENOMEM;
+  } else if (index.count == 0) {
+    free(index.frames);
+    err = ENODATA;
+  } else {
+    replay->frames = index.frames;
+    replay->count = index.count;
+  }
+  if (err) {
+    replay_close(replay);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+static int replay_series(RecCursor *c, ShmSample *sample) {
+  unsigned char present[(SERIES_COUNT + 7) / 8];
+  if (rec_get(c, present, sizeof(present)) != 0) return -1;
+  for (int i = 0; i < SERIES_COUNT; i++) {
+    int64_t value;
+    sample->values[i] = SHM_NO_SAMPLE;
+    if (!(present[i / 8] & (1u << (i % 8)))) continue;
+    if (rec_get(c, &value, sizeof(value)) != 0) return -1;
+    sample->values[i] = (long)value;
+  }
+  uint16_t core_rows;
+  if (rec_get(c, &core_rows, sizeof(core_rows)) != 0 || core_rows > SHM_MAX_CORES) return -1;
+  sample->core_rows = core_rows;
+  return rec_get(c, sample->cores, core_rows);
+}
+
+static int replay_state(RecCursor *c, ShmStateHead *state) {
+  memset(state->titles, 0, sizeof(state->titles));
+  uint16_t titles;
+  if (rec_get_str(c, state->cores_title, TITLE_LEN) != 0 || rec_get(c, &titles, sizeof(titles)) != 0) return -1;
+  for (int t = 0; t < titles; t++) {
+    uint16_t id;
+    if (rec_get(c, &id, sizeof(id)) != 0 || id >= SERIES_COUNT || rec_get_str(c, state->titles[id], TITLE_LEN) != 0)
+      return -1;
+  }
+  unsigned char counts[2];
+  if (rec_get(c, counts, sizeof(counts)) != 0 || counts[0] > MAX_GPUS || counts[1] > MAX_DISKS) return -1;
+  state->gpu_count = counts[0];
+  state->disk_count = counts[1];
+  return rec_get(c, state->disks, (size_t)state->disk_count * sizeof(DiskInfo));
+}
+
+static ProcTable *replay_procs(RecCursor *c, const char *filter) {
+  uint32_t count;
+  if (rec_get(c, &count, sizeof(count)) != 0 || count > (uint32_t)(c->end - c->p)) return NULL;
+  ProcTable *table = proc_table_alloc((int)count);
+  if (!table) return NULL;
+  int rows = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    int32_t ints[7];
+    float floats[3];
+    uint64_t longs[4];
+    char comm[PROC_COMM_LEN];
+    if (rec_get(c, ints, sizeof(ints)) != 0 || rec_get(c, floats, sizeof(floats)) != 0 ||
+        rec_get(c, longs, sizeof(longs)) != 0 || rec_get_str(c, comm, sizeof(comm)) != 0)
+      break;
+    if (!proc_name_matches(comm, filter)) continue;
+    int r = rows++;
+    table->pid[r] = ints[0];
+    table->ppid[r] = ints[1];
+    table->num_threads[r] = ints[2];
+    table->priority[r] = ints[3];
+    table->nice[r] = ints[4];
+    table->processor[r] = ints[5];
+    table->state[r] = (char)ints[6];
+    table->cpu_percent[r] = floats[0];
+    table->mem_percent[r] = floats[1];
+    table->gpu_percent[r] = floats[2];
+    table->rss_kb[r] = longs[0];
+    table->minflt[r] = longs[1];
+    table->majflt[r] = longs[2];
+    table->vram_kb[r] = longs[3];
+    memcpy(table->comm[r], comm, PROC_COMM_LEN);
+  }
+  table->count = rows;
+  return table;
+}
+
+int replay_read(Replay *replay, long n, ShmSample *sample, ShmStateHead *state, ProcTable **procs, const char *filter) {
+  if (n < 0 || n >= replay->count) return -1;
+  uint64_t off = replay->frames[n].offset;
+  RecHead head;
+  uint32_t series_len;
+  if (rec_pread(replay->fd, &head, sizeof(head), off) != 0 || head.kind != REC_FRAME ||
+      head.size < sizeof(series_len) || head.size > REC_MAX_RECORD ||
+      rec_pread(replay->fd, &series_len, sizeof(series_len), off + sizeof(head)) != 0 ||
+      series_len > head.size - sizeof(series_len))
+    return -1;
+
+  // Without state only the series section is read
+  size_t len = state ? head.size - sizeof(series_len) : series_len;
+  RecBuf *buf = &replay->buf;
+  buf->len = 0;
+  buf->failed = 0;
+  if (len > buf->cap) {
+    unsigned char *grown = (unsigned char *)realloc(buf->data, len);
+    if (!grown) return -1;
+    buf->data = grown;
+    buf->cap = len;
+  }
+  if (len && rec_pread(replay->fd, buf->data, len, off + sizeof(head) + sizeof(series_len)) != 0) return -1;
+
+  RecCursor c = {buf->data, buf->data + series_len};
+  if (replay_series(&c, sample) != 0) return -1;
+  if (!state) return 0;
+  c.end = buf->data + len;
+  if (replay_state(&c, state) != 0) return -1;
+  state->proc_count = 0;
+  if (procs) {
+    *procs = replay_procs(&c, filter);
+    if (*procs) state->proc_count = (*procs)->count;
+  }
+  return 0;
+}
+
+void replay_close(Replay *replay) {
+  if (replay->fd >= 0) close(replay->fd);
+  free(replay->frames);
+  free(replay->buf.data);
+  memset(replay, 0, sizeof(*replay));
+  replay->fd = -1;
+}
+
+int flight_init(FlightRing *flight, int cap, int procs, int interval_ms, int core_count, int has_gpu) {
+  memset(flight, 0, sizeof(*flight));
+  size_t frame = REC_FLIGHT_FRAME_BYTES + (size_t)procs * REC_FLIGHT_ROW_BYTES;
+  flight->size = frame * REC_FLIGHT_HEADROOM * (size_t)cap;
+  if (flight->size > REC_FLIGHT_MAX_BYTES) flight->size = REC_FLIGHT_MAX_BYTES;
+  flight->ring = (unsigned char *)malloc(flight->size);
+  flight->frames = (RecIndexEntry *)calloc((size_t)cap, sizeof(RecIndexEntry));
+  flight->lengths = (uint32_t *)calloc((size_t)cap, sizeof(uint32_t));
+  if (!flight->ring || !flight->frames || !flight->lengths) {
+    flight_free(flight);
+    errno = ENOMEM;
+    return -1;
+  }
+  flight->cap = cap;
+  flight->interval_ms = interval_ms;
+  flight->core_count = core_count;
+  flight->has_gpu = has_gpu;
+  return 0;
+}
+
+// Where the next len bytes go: after the newest frame, or at 0 when they do
+// not fit there. On a wrap, *stale is the previous end: every frame from
+// there on is older than the ones at the start of the ring.
+static size_t flight_place(const FlightRing *flight, size_t len, size_t *stale) {
+  *stale = SIZE_MAX;
+  if (!flight->count) return 0;
+  int newest = (flight->first + flight->count - 1) % flight->cap;
+  size_t at = flight->frames[newest].offset + flight->lengths[newest];
+  if (at + len <= flight->size) return at;
+  *stale = at;
+  return 0;
+}
+
+// Whether the oldest frame is in the way of len bytes written at at
+static int flight_evicts(const FlightRing *flight, size_t at, size_t len, size_t stale) {
+  if (!flight->count) return 0;
+  size_t start = flight->frames[flight->first].offset, end = start + flight->lengths[flight->first];
+  return start >= stale || (end > at && start < at + len);
+}
+
+int flight_push(FlightRing *flight, int64_t time_ns, const ShmSample *sample, const ShmStateHead *state, const ProcTable *procs) {
+  if (frame_encode(&flight->buf, time_ns, sample, state, procs) != 0) return -1;
+  size_t len = flight->buf.len;
+  if (len > flight->size) {
+    errno = E2BIG;
+    return -1;
+  }
+
+  if (flight->count == flight->cap) {
+    flight->first = (flight->first + 1) % flight->cap;
+    flight->count--;
+  }
+  size_t stale;
+  size_t at = flight_place(flight, len, &stale);
+  // Bigger frames than the ring was sized for: fewer than cap fit
+  while (flight_evicts(flight, at, len, stale)) {
+    flight->first = (flight->first + 1) % flight->cap;
+    flight->count--;
+    flight->squeezed++;
+  }
+
+  memcpy(flight->ring + at, flight->buf.data, len);
+  int slot = (flight->first + flight->count) % flight->cap;
+  flight->frames[slot] = (RecIndexEntry){time_ns, at};
+  flight->lengths[slot] = (uint32_t)len;
+  flight->count++;
+  return 0;
+}
+
+int flight_dump(const FlightRing *flight, const char *path) {
+  // Always a new file: appending would repeat frames an earlier dump holds
+  Recorder rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (rec.fd < 0) return -1;
+  RecFileHeader header;
+  rec_header_init(&header, flight->interval_ms, flight->core_count, flight->has_gpu);
+  if (rec_pwrite(rec.fd, &header, sizeof(header), 0) != 0) {
+    int err = errno ? errno : EIO;
+    rec_close(&rec);
+    unlink(path);
+    errno = err;
+    return -1;
+  }
+  rec.end = sizeof(header);
+  for (int i = 0; i < flight->count; i++) {
+    int slot = (flight->first + i) % flight->cap;
+    const RecIndexEntry *frame = &flight->frames[slot];
+    if (rec_add_frame(&rec, flight->ring + frame->offset, flight->lengths[slot], frame->time_ns) != 0) {
+      int err = errno;
+      rec_close(&rec);
+      errno = err;
+      return -1;
+    }
+  }
+  rec_close(&rec);
+  return 0;
+}
+
+void flight_free(FlightRing *flight) {
+  free(flight->buf.data);
+  free(flight->ring);
+  free(flight->frames);
+  free(flight->lengths);
+  memset(flight, 0, sizeof(*flight));
+}
@@ -0,0 +1,117 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+#include "shm.h"
+
+// Append-only recording of every tick (`vitals --record`), replayed with
+// `vitals --replay`. After a file header the file is a sequence of
+// records, each framed as RecHead, payload, RecTail so it can be walked
+// in either direction. Every REC_INDEX_EVERY frames an index record lists
+// their offsets and points back at the previous index record, so opening
+// only walks back to the last index and then follows that chain.
+//
+// Frames reuse the shm ring's in-memory form (ShmSample, ShmStateHead,
+// ProcTable) but are stored packed: only sampled series, non-empty titles
+// and variable-length names.
+#define REC_MAGIC 0x52534c56 // "VLSR"
+#define REC_VERSION 1
+#define REC_INDEX_EVERY 256
+// A flight ring is sized up front for frames of REC_FLIGHT_FRAME_BYTES
+// plus REC_FLIGHT_ROW_BYTES per process, this many times over, and at most
+// REC_FLIGHT_MAX_BYTES in all
+#define REC_FLIGHT_HEADROOM 2
+#define REC_FLIGHT_FRAME_BYTES 4096
+#define REC_FLIGHT_ROW_BYTES 96
+#define REC_FLIGHT_MAX_BYTES ((size_t)256 << 20)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  // Replays need a build with the same layout
+  uint32_t series_count;
+  uint32_t title_len;
+  uint32_t disk_info_size;
+  int32_t interval_ms;
+  int32_t core_count;
+  int32_t has_gpu;
+} RecFileHeader;
+
+typedef struct {
+  int64_t time_ns; // CLOCK_REALTIME of the tick
+  uint64_t offset;
+} RecIndexEntry;
+
+// Growable encode/decode buffer, reused from tick to tick
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+  int failed; // an allocation failed; the contents are incomplete
+} RecBuf;
+
+typedef struct {
+  int fd;
+  uint64_t end;        // where the next record goes
+  uint64_t last_index; // offset of the latest index record, 0 if none
+  RecIndexEntry pending[REC_INDEX_EVERY]; // frames not in an index yet
+  int pending_count;
+  RecBuf buf;
+} Recorder;
+
+typedef struct {
+  int fd;
+  RecFileHeader header;
+  RecIndexEntry *frames;
+  long count;
+  RecBuf buf;
+} Replay;
+
+// Creates path or appends to an earlier recording of the same layout,
+// interval, core count and GPU presence. Fails with EBUSY if another
+// process records to it and EPROTO if it is not a recording this run can
+// extend.
+int rec_create(Recorder *rec, const char *path, int interval_ms, int core_count, int has_gpu);
+int rec_write(Recorder *rec, int64_t time_ns, const ShmSample *sample, const ShmStateHead *state, const ProcTable *procs);
+void rec_close(Recorder *rec);
+
+// Flight recorder (--flight): the last cap frames, encoded as in a
+// recording and kept in one fixed byte ring allocated by flight_init. A
+// frame is stored whole; one that does not fit before the end of the ring
+// starts over at offset 0, evicting the frames past the previous end and
+// then the oldest ones it overlaps. Frames that went before cap were held,
+// because the ring was full, are counted in squeezed. Dumping writes an
+// ordinary recording.
+typedef struct {
+  RecBuf buf;
+  unsigned char *ring;
+  size_t size;
+  RecIndexEntry *frames; // offset is into ring
+  uint32_t *lengths;
+  int cap;
+  int first; // oldest frame
+  int count;
+  long squeezed;
+  int interval_ms; // between frames
+  int core_count;
+  int has_gpu;
+} FlightRing;
+
+// procs is the expected process count; it only sizes the ring
+int flight_init(FlightRing *flight, int cap, int procs, int interval_ms, int core_count, int has_gpu);
+int flight_push(FlightRing *flight, int64_t time_ns, const ShmSample *sample, const ShmStateHead *state, const ProcTable *procs);
+// Write the frames held to a new recording at path for --replay. Fails
+// with EEXIST if path exists.
+int flight_dump(const FlightRing *flight, const char *path);
+void flight_free(FlightRing *flight);
+
+// Loads the frame index. Fails with EPROTO for a file that is not a
+// recording of this layout.
+int replay_open(Replay *replay, const char *path);
+// Decode frame n into sample. With state set, also its state, and with
+// procs set a table of the rows whose name matches filter.
+int replay_read(Replay *replay, long n, ShmSample *sample, ShmStateHead *state, ProcTable **procs, const char *filter);
+void replay_close(Replay *replay);
+
+#endif
@@ -0,0 +1,294 @@
+#include "shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Sections start on cache-line boundaries
+#define SHM_ALIGN 64
+// Torn reads of the state are retried this many times per call
+#define SHM_READ_TRIES 4
+
+static size_t shm_align(size_t n) {
+  return (n + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+static size_t shm_ring_offset() {
+  return shm_align(sizeof(ShmHeader));
+}
+
+static size_t shm_states_offset() {
+  return shm_ring_offset() + shm_align(sizeof(ShmSample) * SHM_RING_LEN);
+}
+
+static size_t shm_size() {
+  return shm_states_offset() + shm_align(sizeof(ShmState)) * SHM_STATE_SLOTS;
+}
+
+static void shm_ring_map(ShmRing *ring, char *base) {
+  ring->header = (ShmHeader *)base;
+  ring->ring = (ShmSample *)(base + shm_ring_offset());
+  ring->states = (ShmState *)(base + shm_states_offset());
+}
+
+static ShmState *shm_state_at(const ShmRing *ring, unsigned long long n) {
+  return (ShmState *)((char *)ring->states + shm_align(sizeof(ShmState)) * (n % SHM_STATE_SLOTS));
+}
+
+// The ring lives at a fixed path in a world-writable directory, so only a
+// plain file owned by owner (or root, if root_ok) with no other links and
+// not writable by anyone else is used
+static int shm_file_trusted(int fd, uid_t owner, int root_ok) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) return 0;
+  return S_ISREG(st.st_mode) && st.st_nlink == 1 && (st.st_uid == owner || (root_ok && st.st_uid == 0)) &&
+         !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+int shm_ring_create(ShmRing *ring, int interval_ms, int core_count, int has_gpu) {
+  memset(ring, 0, sizeof(*ring));
+  // Never follow a link planted at the path; an existing file is reused
+  // only if it is ours (left by an earlier daemon)
+  ring->fd = open(SHM_PATH, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+  if (ring->fd < 0 && errno == EEXIST) {
+    ring->fd = open(SHM_PATH, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+    if (ring->fd >= 0 && !shm_file_trusted(ring->fd, geteuid(), 0)) {
+      close(ring->fd);
+      ring->fd = -1;
+      errno = EPERM;
+    }
+  }
+  if (ring->fd < 0) {
+    if (errno == ELOOP) errno = EPERM;
+    return -1;
+  }
+  // Held for the daemon's lifetime; viewers probe it to tell a stale file
+  if (flock(ring->fd, LOCK_EX | LOCK_NB) != 0) {
+    close(ring->fd);
+    ring->fd = -1;
+    errno = EBUSY;
+    return -1;
+  }
+
+  // Truncating first zeroes whatever a previous daemon left behind. The
+  // file stays sparse: pages are only allocated as rows get written.
+  ring->size = shm_size();
+  void *base = MAP_FAILED;
+  if (ftruncate(ring->fd, 0) == 0 && ftruncate(ring->fd, (off_t)ring->size) == 0)
+    base = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+  if (base == MAP_FAILED) {
+    int err = errno;
+    unlink(SHM_PATH);
+    close(ring->fd);
+    ring->fd = -1;
+    errno = err;
+    return -1;
+  }
+  // Readable by everyone regardless of the umask
+  fchmod(ring->fd, 0644);
+
+  ring->writer = 1;
+  shm_ring_map(ring, (char *)base);
+  ShmHeader *h = ring->header;
+  h->version = SHM_VERSION;
+  h->series_count = SERIES_COUNT;
+  h->title_len = TITLE_LEN;
+  h->sample_size = sizeof(ShmSample);
+  h->state_size = sizeof(ShmState);
+  h->interval_ms = interval_ms;
+  h->core_count = core_count;
+  h->has_gpu = has_gpu;
+  atomic_store(&h->seq, 0);
+  atomic_thread_fence(memory_order_release);
+  h->magic = SHM_MAGIC;
+  return 0;
+}
+
+ShmSample *shm_sample_begin(ShmRing *ring) {
+  unsigned long long n = atomic_load_explicit(&ring->header->seq, memory_order_relaxed) + 1;
+  ShmSample *sample = &ring->ring[n % SHM_RING_LEN];
+  atomic_store_explicit(&sample->seq, 2 * n - 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  return sample;
+}
+
+ShmState *shm_state_begin(ShmRing *ring) {
+  unsigned long long n = atomic_load_explicit(&ring->header->seq, memory_order_relaxed) + 1;
+  ShmState *state = shm_state_at(ring, n);
+  atomic_store_explicit(&state->head.seq, 2 * n - 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  return state;
+}
+
+void shm_state_set_procs(ShmState *state, const ProcTable *table) {
+  int count = table ? table->count : 0;
+  // A table too big for the ring is taken in sort order, so the rows that
+  // are left out are the ones a viewer would list last
+  int in_order = count > SHM_MAX_PROCS && table->sorted >= SHM_MAX_PROCS;
+  if (count > SHM_MAX_PROCS) count = SHM_MAX_PROCS;
+  for (int i = 0; i < count; i++) {
+    int r = in_order ? table->order[i] : i;
+    ShmProc *p = &state->procs[i];
+    p->pid = table->pid[r];
+    p->state = table->state[r];
+    p->ppid = table->ppid[r];
+    p->cpu_percent = table->cpu_percent[r];
+    p->mem_percent = table->mem_percent[r];
+    p->rss_kb = table->rss_kb[r];
+    p->num_threads = table->num_threads[r];
+    p->priority = table->priority[r];
+    p->nice = table->nice[r];
+    p->processor = table->processor[r];
+    p->minflt = table->minflt[r];
+    p->majflt = table->majflt[r];
+    p->gpu_percent = table->gpu_percent[r];
+    p->vram_kb = table->vram_kb[r];
+    memcpy(p->comm, table->comm[r], PROC_COMM_LEN);
+  }
+  state->head.proc_count = count;
+}
+
+// Mark both slots of the next tick complete, then publish it
+void shm_ring_commit(ShmRing *ring) {
+  unsigned long long n = atomic_load_explicit(&ring->header->seq, memory_order_relaxed) + 1;
+  atomic_store_explicit(&ring->ring[n % SHM_RING_LEN].seq, 2 * n, memory_order_release);
+  atomic_store_explicit(&shm_state_at(ring, n)->head.seq, 2 * n, memory_order_release);
+  atomic_store_explicit(&ring->header->seq, n, memory_order_release);
+}
+
+int shm_ring_attach(ShmRing *ring) {
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = open(SHM_PATH, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (ring->fd < 0) {
+    if (errno == ELOOP) errno = EPERM;
+    return -1;
+  }
+  // Anyone can create the path; only trust a daemon run by us or root
+  if (!shm_file_trusted(ring->fd, getuid(), 1)) {
+    close(ring->fd);
+    ring->fd = -1;
+    errno = EPERM;
+    return -1;
+  }
+
+  // A file nobody holds locked is left over from a daemon that died
+  ring->size = shm_size();
+  struct stat st;
+  int err = 0;
+  if (fstat(ring->fd, &st) != 0) err = errno;
+  else if (!shm_ring_alive(ring)) err = ENOENT;
+  else if ((size_t)st.st_size != ring->size) err = EPROTO;
+  void *base = err ? MAP_FAILED : mmap(NULL, ring->size, PROT_READ, MAP_SHARED, ring->fd, 0);
+  if (base == MAP_FAILED) {
+    if (!err) err = errno;
+    close(ring->fd);
+    ring->fd = -1;
+    errno = err;
+    return -1;
+  }
+
+  shm_ring_map(ring, (char *)base);
+  const ShmHeader *h = ring->header;
+  if (h->magic != SHM_MAGIC) {
+    // Still starting up
+    shm_ring_close(ring);
+    errno = ENOENT;
+    return -1;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  if (h->version != SHM_VERSION || h->series_count != SERIES_COUNT || h->title_len != TITLE_LEN ||
+      h->sample_size != sizeof(ShmSample) || h->state_size != sizeof(ShmState)) {
+    shm_ring_close(ring);
+    errno = EPROTO;
+    return -1;
+  }
+  return 0;
+}
+
+unsigned long long shm_ring_seq(const ShmRing *ring) {
+  return atomic_load_explicit(&ring->header->seq, memory_order_acquire);
+}
+
+// The daemon holds an exclusive lock; getting a shared one means it is gone
+int shm_ring_alive(const ShmRing *ring) {
+  if (flock(ring->fd, LOCK_SH | LOCK_NB) != 0) return errno == EWOULDBLOCK;
+  flock(ring->fd, LOCK_UN);
+  return 0;
+}
+
+int shm_sample_read(const ShmRing *ring, unsigned long long n, ShmSample *out) {
+  const ShmSample *sample = &ring->ring[n % SHM_RING_LEN];
+  if (atomic_load_explicit(&sample->seq, memory_order_acquire) != 2 * n) return -1;
+  memcpy(out->values, sample->values, sizeof(out->values));
+  out->core_rows = sample->core_rows;
+  if (out->core_rows < 0 || out->core_rows > SHM_MAX_CORES) out->core_rows = 0;
+  memcpy(out->cores, sample->cores, (size_t)out->core_rows);
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&sample->seq, memory_order_relaxed) == 2 * n ? 0 : -1;
+}
+
+static ProcTable *shm_procs_read(const ShmState *state, int count, const char *filter) {
+  ProcTable *table = proc_table_alloc(count);
+  if (!table) return NULL;
+  int rows = 0;
+  for (int i = 0; i < count; i++) {
+    const ShmProc *p = &state->procs[i];
+    if (!proc_name_matches(p->comm, filter)) continue;
+    int r = rows++;
+    table->pid[r] = p->pid;
+    table->state[r] = p->state;
+    table->ppid[r] = p->ppid;
+    table->cpu_percent[r] = p->cpu_percent;
+    table->mem_percent[r] = p->mem_percent;
+    table->rss_kb[r] = p->rss_kb;
+    table->num_threads[r] = p->num_threads;
+    table->priority[r] = p->priority;
+    table->nice[r] = p->nice;
+    table->processor[r] = p->processor;
+    table->minflt[r] = p->minflt;
+    table->majflt[r] = p->majflt;
+    table->gpu_percent[r] = p->gpu_percent;
+    table->vram_kb[r] = p->vram_kb;
+    memcpy(table->comm[r], p->comm, PROC_COMM_LEN);
+    table->comm[r][PROC_COMM_LEN - 1] = '\0';
+  }
+  table->count = rows;
+  return table;
+}
+
+unsigned long long shm_state_read(const ShmRing *ring, ShmStateHead *out, ProcTable **procs, const char *filter) {
+  for (int tries = 0; tries < SHM_READ_TRIES; tries++) {
+    unsigned long long n = shm_ring_seq(ring);
+    if (n == 0) return 0;
+    const ShmState *state = shm_state_at(ring, n);
+    if (atomic_load_explicit(&state->head.seq, memory_order_acquire) != 2 * n) continue;
+
+    memcpy(out, &state->head, sizeof(*out));
+    int count = out->proc_count;
+    if (count < 0 || count > SHM_MAX_PROCS) count = 0;
+    ProcTable *table = procs ? shm_procs_read(state, count, filter) : NULL;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&state->head.seq, memory_order_relaxed) != 2 * n) {
+      proc_table_unref(table);
+      continue;
+    }
+    if (out->disk_count < 0 || out->disk_count > MAX_DISKS) out->disk_count = 0;
+    if (out->gpu_count < 0 || out->gpu_count > MAX_GPUS) out->gpu_count = 0;
+    if (procs) *procs = table;
+    return n;
+  }
+  return 0;
+}
+
+void shm_ring_close(ShmRing *ring) {
+  if (ring->header) munmap(ring->header, ring->size);
+  // Unlink while the lock is held, so a daemon that takes over the path
+  // afterwards keeps it
+  if (ring->writer) unlink(SHM_PATH);
+  if (ring->fd >= 0) close(ring->fd);
+  ring->header = NULL;
+  ring->fd = -1;
+}
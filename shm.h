@@ -0,0 +1,119 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "snapshot.h"
+
+// Shared-memory ring written by `vitals --daemon` and read by any number of
+// `vitals --attach` viewers. Layout: header, SHM_RING_LEN per-tick samples
+// (the viewers' history), SHM_STATE_SLOTS copies of the latest state
+// (titles, disks, process table).
+//
+// Every sample and state slot is a seqlock: seq is odd while the daemon
+// writes it and 2n once tick n is complete. Viewers copy a slot and keep
+// the copy only if seq still reads 2n afterwards, so they never block the
+// daemon and the daemon's cost does not depend on how many are attached.
+#define SHM_PATH "/dev/shm/vitals"
+#define SHM_MAGIC 0x534c5456 // "VTLS"
+#define SHM_VERSION 1
+#define SHM_RING_LEN 1024
+#define SHM_STATE_SLOTS 3
+#define SHM_MAX_CORES 1024
+#define SHM_MAX_PROCS 32768
+#define SHM_NO_SAMPLE LONG_MIN // series not sampled in that tick
+
+typedef struct {
+  atomic_ullong seq;
+  long values[SERIES_COUNT]; // SHM_NO_SAMPLE where nothing was pushed
+  int core_rows;             // 0 when no core column was sampled
+  unsigned char cores[SHM_MAX_CORES];
+} ShmSample;
+
+// One process table row, as in ProcTable
+typedef struct {
+  int pid;
+  char state;
+  int ppid;
+  double cpu_percent;
+  double mem_percent;
+  unsigned long rss_kb;
+  int num_threads;
+  int priority;
+  int nice;
+  int processor;
+  unsigned long minflt;
+  unsigned long majflt;
+  double gpu_percent;
+  unsigned long vram_kb;
+  char comm[PROC_COMM_LEN];
+} ShmProc;
+
+typedef struct {
+  atomic_ullong seq;
+  char titles[SERIES_COUNT][TITLE_LEN];
+  char cores_title[TITLE_LEN];
+  int gpu_count;
+  int disk_count;
+  DiskInfo disks[MAX_DISKS];
+  int proc_count;
+} ShmStateHead;
+
+typedef struct {
+  ShmStateHead head;
+  ShmProc procs[SHM_MAX_PROCS]; // only [0, head.proc_count) is written
+} ShmState;
+
+typedef struct {
+  uint32_t magic; // written last, once the rest is valid
+  uint32_t version;
+  // A viewer only attaches to a daemon built with the same layout
+  uint32_t series_count;
+  uint32_t title_len;
+  uint64_t sample_size;
+  uint64_t state_size;
+  int32_t interval_ms;
+  int32_t core_count;
+  int32_t has_gpu;
+  atomic_ullong seq; // last complete tick
+} ShmHeader;
+
+typedef struct {
+  int fd;
+  int writer; // the daemon; removes the file on close
+  size_t size;
+  ShmHeader *header;
+  ShmSample *ring;
+  ShmState *states;
+} ShmRing;
+
+// Daemon side. Fails with EBUSY if another daemon owns the ring and EPERM
+// if something other than our own ring file is at SHM_PATH.
+int shm_ring_create(ShmRing *ring, int interval_ms, int core_count, int has_gpu);
+// Slots for the next tick; fill both, then commit
+ShmSample *shm_sample_begin(ShmRing *ring);
+ShmState *shm_state_begin(ShmRing *ring);
+// Rows past SHM_MAX_PROCS are dropped; sort the table that deep first to
+// keep its top rows
+void shm_state_set_procs(ShmState *state, const ProcTable *table);
+void shm_ring_commit(ShmRing *ring);
+
+// Viewer side. Fails with ENOENT when no daemon runs, EPROTO when it was
+// built with a different layout and EPERM when the file at SHM_PATH is not
+// one a daemon run by us or root created.
+int shm_ring_attach(ShmRing *ring);
+unsigned long long shm_ring_seq(const ShmRing *ring);
+int shm_ring_alive(const ShmRing *ring);
+// Copy tick n; -1 if it was already overwritten (or is not complete)
+int shm_sample_read(const ShmRing *ring, unsigned long long n, ShmSample *out);
+// Copy the latest state without the process rows into out. With procs set,
+// also build a table of the rows whose name matches filter.
+// Returns the tick read, 0 if there is none yet.
+unsigned long long shm_state_read(const ShmRing *ring, ShmStateHead *out, ProcTable **procs, const char *filter);
+
+void shm_ring_close(ShmRing *ring);
+
+#endif
@@ -0,0 +1,60 @@
+#include "snapshot.h"
+
+// Current + one being written + a few pinned by readers.
+#define SNAPSHOT_POOL 8
+// Added to refs while the writer owns a slot, so stray reader
+// increments/decrements on that slot still balance out.
+#define SNAPSHOT_WRITER (1 << 24)
+
+static Snapshot pool[SNAPSHOT_POOL];
+static _Atomic(Snapshot *) current = NULL;
+
+void snapshot_pool_init() {
+  memset(pool, 0, sizeof(pool));
+  for (int i = 0; i < SNAPSHOT_POOL; i++) atomic_init(&pool[i].refs, 0);
+  atomic_store(&current, NULL);
+}
+
+void snapshot_pool_free() {
+  atomic_store(&current, NULL);
+  for (int i = 0; i < SNAPSHOT_POOL; i++) {
+    for (int s = 0; s < SERIES_COUNT; s++) series_free(&pool[i].series[s]);
+    heatmap_free(&pool[i].cores);
+    proc_table_unref(pool[i].proc_table);
+  }
+  memset(pool, 0, sizeof(pool));
+}
+
+// Claim a slot that is neither published nor pinned by a reader.
+// Returns NULL if every slot is busy; the caller skips publishing then.
+Snapshot *snapshot_begin() {
+  Snapshot *cur = atomic_load(&current);
+  for (int i = 0; i < SNAPSHOT_POOL; i++) {
+    if (&pool[i] == cur) continue;
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&pool[i].refs, &expected, SNAPSHOT_WRITER)) {
+      return &pool[i];
+    }
+  }
+  return NULL;
+}
+
+void snapshot_publish(Snapshot *snap) {
+  atomic_fetch_sub(&snap->refs, SNAPSHOT_WRITER);
+  atomic_store(&current, snap);
+}
+
+Snapshot *snapshot_acquire() {
+  for (;;) {
+    Snapshot *snap = atomic_load(&current);
+    if (!snap) return NULL;
+    atomic_fetch_add(&snap->refs, 1);
+    // Still current after pinning: the writer can no longer claim it
+    if (atomic_load(&current) == snap) return snap;
+    atomic_fetch_sub(&snap->refs, 1);
+  }
+}
+
+void snapshot_release(Snapshot *snap) {
+  if (snap) atomic_fetch_sub(&snap->refs, 1);
+}
@@ -0,0 +1,74 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdatomic.h>
+
+#include "modules.h"
+#include "process.h"
+#include "utils.h"
+
+#define MAX_DISKS 8
+#define TITLE_LEN 100
+
+// Every graphable series has a fixed id; each GPU has one id in the
+// SERIES_GPU and SERIES_VRAM blocks, and each disk slot takes
+// DISK_METRIC_COUNT consecutive ids (see DISK_SERIES).
+typedef enum {
+  SERIES_CPU = 0,
+  SERIES_MEM,
+  SERIES_GPU_ALL, // average over all GPUs
+  SERIES_VRAM_ALL,
+  SERIES_GPU,
+  SERIES_VRAM = SERIES_GPU + MAX_GPUS,
+  SERIES_NET_UP = SERIES_VRAM + MAX_GPUS,
+  SERIES_NET_DOWN,
+  SERIES_DISK,
+  SERIES_COUNT = SERIES_DISK + MAX_DISKS * DISK_METRIC_COUNT
+} SeriesId;
+
+#define GPU_SERIES(index) ((SeriesId)(SERIES_GPU + (index)))
+#define VRAM_SERIES(index) ((SeriesId)(SERIES_VRAM + (index)))
+#define DISK_SERIES(slot, metric) ((SeriesId)(SERIES_DISK + (slot) * DISK_METRIC_COUNT + (metric)))
+
+// One complete, immutable (once published) view of everything the UI shows.
+typedef struct {
+  atomic_int refs;
+
+  Series series[SERIES_COUNT];
+  char titles[SERIES_COUNT][TITLE_LEN];
+
+  // Per-core utilization history, one row per cpuN line
+  Heatmap cores;
+  char cores_title[TITLE_LEN];
+
+  // Latest values, unrounded (exporter)
+  float cpu;
+  float mem;
+  char net_interface[32];
+  unsigned long net_up;
+  unsigned long net_down;
+
+  int gpu_count;
+  GpuSample gpus[MAX_GPUS];
+
+  int disk_count;
+  DiskInfo disks[MAX_DISKS];
+
+  // Only proc_table->order[0, proc_sorted) may be read; the rest can
+  // still be reordered by the stats thread.
+  ProcTable *proc_table;
+  int proc_sorted;
+} Snapshot;
+
+void snapshot_pool_init();
+void snapshot_pool_free();
+
+// Writer side (single stats thread)
+Snapshot *snapshot_begin();
+void snapshot_publish(Snapshot *snap);
+
+// Reader side (any thread). Never blocks on the writer.
+Snapshot *snapshot_acquire();
+void snapshot_release(Snapshot *snap);
+
+#endif
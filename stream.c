@@ -0,0 +1,127 @@
+#include "stream.h"
+
+// Key used for each disk metric in records and CSV headers
+static const char *disk_metric_keys[DISK_METRIC_COUNT] = {
+  [DISK_BUSY] = "busy",
+  [DISK_READ_BPS] = "read_bps",
+  [DISK_WRITE_BPS] = "write_bps",
+  [DISK_READ_IOPS] = "read_iops",
+  [DISK_WRITE_IOPS] = "write_iops",
+  [DISK_AWAIT] = "await_ms",
+  [DISK_QUEUE] = "queue",
+  [DISK_DISCARD_IOPS] = "discard_iops",
+  [DISK_FLUSH_IOPS] = "flush_iops",
+};
+
+// Fits 1024 cores, MAX_GPUS and MAX_DISKS with every metric
+#define STREAM_HEADER_LEN 16384
+
+StreamFormat stream_format(const char *name) {
+  if (strcmp(name, "jsonl") == 0) return STREAM_JSONL;
+  if (strcmp(name, "csv") == 0) return STREAM_CSV;
+  return STREAM_NONE;
+}
+
+// Percentages with one decimal; JSON null / empty CSV field when unknown
+static void write_perc(FILE *out, StreamFormat format, float value) {
+  if (value >= 0) fprintf(out, "%.1f", value);
+  else if (format == STREAM_JSONL) fputs("null", out);
+}
+
+// Unknown (negative) metrics are left empty like write_perc()
+static void write_disk_metric(FILE *out, StreamFormat format, int metric, double value) {
+  if (value < 0) {
+    if (format == STREAM_JSONL) fputs("null", out);
+  } else if (metric == DISK_BUSY || metric == DISK_QUEUE) fprintf(out, "%.2f", value);
+  else if (metric == DISK_AWAIT) fprintf(out, "%.3f", value);
+  else fprintf(out, "%.0f", value);
+}
+
+static void write_jsonl(FILE *out, const StreamRecord *rec) {
+  fprintf(out, "{\"time\":%.3f,\"cpu\":", rec->time);
+  write_perc(out, STREAM_JSONL, rec->cpu);
+  fputs(",\"mem\":", out);
+  write_perc(out, STREAM_JSONL, rec->mem);
+  fputs(",\"cores\":[", out);
+  for (int i = 0; i < rec->core_count; i++) {
+    if (i) fputc(',', out);
+    write_perc(out, STREAM_JSONL, rec->cores[i]);
+  }
+  fprintf(out, "],\"net\":{\"up\":%lu,\"down\":%lu},\"gpus\":[", rec->net_up, rec->net_down);
+  for (int i = 0; i < rec->gpu_count; i++) {
+    const GpuSample *gpu = &rec->gpus[i];
+    fprintf(out, "%s{\"name\":\"%s\",\"util\":", i ? "," : "", gpu->name);
+    write_perc(out, STREAM_JSONL, gpu->util);
+    fputs(",\"vram\":", out);
+    write_perc(out, STREAM_JSONL, gpu->vram);
+    fputc('}', out);
+  }
+  fputs("],\"disks\":[", out);
+  for (int i = 0; i < rec->disk_count; i++) {
+    const DiskInfo *disk = &rec->disks[i];
+    fprintf(out, "%s{\"name\":\"%s\",\"type\":\"%s\"", i ? "," : "", disk->device_name, disk->disk_type);
+    for (int m = 0; m < DISK_METRIC_COUNT; m++) {
+      fprintf(out, ",\"%s\":", disk_metric_keys[m]);
+      write_disk_metric(out, STREAM_JSONL, m, disk->metrics[m]);
+    }
+    fputc('}', out);
+  }
+  fputs("]}\n", out);
+}
+
+// Column names for this record's devices
+static void csv_header(char *buf, size_t size, const StreamRecord *rec) {
+  size_t len = 0;
+#define HEADER_APPEND(...) \
+  do { \
+    if (len < size) len += (size_t)snprintf(buf + len, size - len, __VA_ARGS__); \
+  } while (0)
+  HEADER_APPEND("time,cpu,mem");
+  for (int i = 0; i < rec->core_count; i++) HEADER_APPEND(",core%d", i);
+  HEADER_APPEND(",net_up,net_down");
+  for (int i = 0; i < rec->gpu_count; i++) HEADER_APPEND(",gpu.%s.util,gpu.%s.vram", rec->gpus[i].name, rec->gpus[i].name);
+  for (int i = 0; i < rec->disk_count; i++) {
+    for (int m = 0; m < DISK_METRIC_COUNT; m++) HEADER_APPEND(",disk.%s.%s", rec->disks[i].device_name, disk_metric_keys[m]);
+  }
+#undef HEADER_APPEND
+}
+
+static void write_csv(FILE *out, const StreamRecord *rec) {
+  static char header[STREAM_HEADER_LEN];
+  static char prev_header[STREAM_HEADER_LEN];
+  csv_header(header, sizeof(header), rec);
+  if (strcmp(header, prev_header) != 0) {
+    fprintf(out, "%s\n", header);
+    memcpy(prev_header, header, sizeof(prev_header));
+  }
+
+  fprintf(out, "%.3f,", rec->time);
+  write_perc(out, STREAM_CSV, rec->cpu);
+  fputc(',', out);
+  write_perc(out, STREAM_CSV, rec->mem);
+  for (int i = 0; i < rec->core_count; i++) {
+    fputc(',', out);
+    write_perc(out, STREAM_CSV, rec->cores[i]);
+  }
+  fprintf(out, ",%lu,%lu", rec->net_up, rec->net_down);
+  for (int i = 0; i < rec->gpu_count; i++) {
+    fputc(',', out);
+    write_perc(out, STREAM_CSV, rec->gpus[i].util);
+    fputc(',', out);
+    write_perc(out, STREAM_CSV, rec->gpus[i].vram);
+  }
+  for (int i = 0; i < rec->disk_count; i++) {
+    for (int m = 0; m < DISK_METRIC_COUNT; m++) {
+      fputc(',', out);
+      write_disk_metric(out, STREAM_CSV, m, rec->disks[i].metrics[m]);
+    }
+  }
+  fputc('\n', out);
+}
+
+int stream_write(FILE *out, StreamFormat format, const StreamRecord *rec) {
+  if (format == STREAM_JSONL) write_jsonl(out, rec);
+  else if (format == STREAM_CSV) write_csv(out, rec);
+  else return -1;
+  return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,35 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+
+#include "modules.h"
+
+// --stream: one record per sampling pass, for pipes and log shippers
+typedef enum {
+  STREAM_NONE = 0,
+  STREAM_JSONL,
+  STREAM_CSV
+} StreamFormat;
+
+// Everything one pass measured; the pointers are only read during the call
+typedef struct {
+  double time; // seconds since the epoch
+  float cpu;   // %, -1 without a previous sample
+  float mem;   // %
+  const float *cores; // per-core %, same
+  int core_count;
+  unsigned long net_up; // bytes/s
+  unsigned long net_down;
+  const GpuSample *gpus;
+  int gpu_count;
+  const DiskInfo *disks;
+  int disk_count;
+} StreamRecord;
+
+StreamFormat stream_format(const char *name);
+// Appends to out's buffer; CSV repeats its header whenever the set of
+// columns changes (hotplugged disk, GPU appearing). Returns -1 on error.
+int stream_write(FILE *out, StreamFormat format, const StreamRecord *rec);
+
+#endif
@@ -0,0 +1,99 @@
+#include "sysstat.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "counter.h"
+
+static CounterSource stat_src = COUNTER_SOURCE_INIT("/proc/stat");
+
+static const char *skip_spaces(const char *p) {
+  while (*p == ' ') p++;
+  return p;
+}
+
+static const char *parse_ull(const char *p, unsigned long long *out) {
+  unsigned long long v = 0;
+  p = skip_spaces(p);
+  while (*p >= '0' && *p <= '9') v = v * 10 + (unsigned long long)(*p++ - '0');
+  *out = v;
+  return p;
+}
+
+static const char *next_line(const char *p) {
+  const char *nl = strchr(p, '\n');
+  return nl ? nl + 1 : NULL;
+}
+
+// Fields missing on older kernels stay zero
+static const char *parse_cpu_times(const char *p, CpuTimes *c) {
+  for (int i = 0; i < CPU_TIME_FIELDS; i++) {
+    p = skip_spaces(p);
+    if (*p < '0' || *p > '9') {
+      c->t[i] = 0;
+      continue;
+    }
+    p = parse_ull(p, &c->t[i]);
+  }
+  return p;
+}
+
+static CpuTimes *sysstat_next_cpu(SysStat *st) {
+  if (st->cpu_count == st->cpu_cap) {
+    int cap = st->cpu_cap ? st->cpu_cap * 2 : 16;
+    CpuTimes *grown = (CpuTimes *)realloc(st->cpus, (size_t)cap * sizeof(CpuTimes));
+    if (!grown) return NULL;
+    st->cpus = grown;
+    st->cpu_cap = cap;
+  }
+  return &st->cpus[st->cpu_count++];
+}
+
+int sysstat_read(SysStat *st) {
+  const char *p = counter_read(&stat_src, NULL);
+  st->valid = 0;
+  st->cpu_count = 0;
+  if (!p) return -1;
+
+  unsigned long long v;
+  for (; p && *p; p = next_line(p)) {
+    if (p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+      if (p[3] == ' ') {
+        st->total.id = -1;
+        parse_cpu_times(p + 3, &st->total);
+        st->valid = 1;
+      } else {
+        CpuTimes *c = sysstat_next_cpu(st);
+        if (!c) return -1;
+        p = parse_ull(p + 3, &v);
+        c->id = (int)v;
+        p = parse_cpu_times(p, c);
+      }
+    } else if (strncmp(p, "intr ", 5) == 0) {
+      // Only the total; the per-irq counts make up most of the file
+      parse_ull(p + 5, &st->intr);
+    } else if (strncmp(p, "ctxt ", 5) == 0) {
+      parse_ull(p + 5, &st->ctxt);
+    } else if (strncmp(p, "processes ", 10) == 0) {
+      parse_ull(p + 10, &st->processes);
+    } else if (strncmp(p, "procs_running ", 14) == 0) {
+      parse_ull(p + 14, &v);
+      st->procs_running = (unsigned long)v;
+    } else if (strncmp(p, "procs_blocked ", 14) == 0) {
+      parse_ull(p + 14, &v);
+      st->procs_blocked = (unsigned long)v;
+    }
+  }
+  return st->valid ? 0 : -1;
+}
+
+void sysstat_free(SysStat *st) {
+  free(st->cpus);
+  memset(st, 0, sizeof(*st));
+}
+
+unsigned long long cpu_times_total(const CpuTimes *c) {
+  unsigned long long sum = 0;
+  for (int i = 0; i < CPU_GUEST; i++) sum += c->t[i];
+  return sum;
+}
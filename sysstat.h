@@ -0,0 +1,45 @@
+#ifndef SYSSTAT_H
+#define SYSSTAT_H
+
+// user nice system idle iowait irq softirq steal guest guest_nice
+#define CPU_TIME_FIELDS 10
+
+typedef enum {
+  CPU_USER = 0,
+  CPU_NICE,
+  CPU_SYSTEM,
+  CPU_IDLE,
+  CPU_IOWAIT,
+  CPU_IRQ,
+  CPU_SOFTIRQ,
+  CPU_STEAL,
+  CPU_GUEST,
+  CPU_GUEST_NICE
+} CpuTimeField;
+
+typedef struct {
+  int id; // N of the cpuN line, -1 for the aggregate
+  unsigned long long t[CPU_TIME_FIELDS];
+} CpuTimes;
+
+// One parse of /proc/stat. Everything that needs CPU or scheduler counters
+// for a tick reads the same sample, so the views never disagree.
+typedef struct {
+  int valid;
+  CpuTimes total;
+  CpuTimes *cpus; // in file order; offline CPUs have no line
+  int cpu_count;
+  int cpu_cap;
+  unsigned long long intr;
+  unsigned long long ctxt;
+  unsigned long long processes; // forks since boot
+  unsigned long procs_running;
+  unsigned long procs_blocked;
+} SysStat;
+
+int sysstat_read(SysStat *st);
+void sysstat_free(SysStat *st);
+
+// Sum of every field except guest time (already counted in user/nice)
+unsigned long long cpu_times_total(const CpuTimes *c);
+#endif
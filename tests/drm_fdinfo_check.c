@@ -0,0 +1,51 @@
+// Checks the DRM fdinfo walk against the /proc-shaped tree in
+// tests/fixtures/proc, so it runs without a GPU. Built by `make check`.
+#include "../process.c"
+
+static int failures;
+
+static void expect(const char *what, unsigned long long got, unsigned long long want) {
+  if (got == want) return;
+  fprintf(stderr, "FAIL %s: got %llu, want %llu\n", what, got, want);
+  failures++;
+}
+
+static ProcStat walk(int proc_fd, int pid) {
+  ProcStat st;
+  memset(&st, 0, sizeof(st));
+  st.drm_fds = -1;
+  read_proc_drm(proc_fd, pid, &st);
+  return st;
+}
+
+int main(int argc, char *argv[]) {
+  const char *root = argc > 1 ? argv[1] : "tests/fixtures/proc";
+  int proc_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (proc_fd < 0) {
+    perror(root);
+    return 1;
+  }
+
+  // fd 3 and its dup 4 share drm-client-id 7, fd 5 is not a DRM fd, fd 7
+  // is a DRM fd without client stats. Client 7 reports resident vram,
+  // client 8 only drm-total; capacity lines are not busy time.
+  ProcStat st = walk(proc_fd, 100);
+  expect("100 drm_fds", (unsigned long long)st.drm_fds, 2);
+  expect("100 gpu_ns", st.gpu_ns, 1000000 + 500 + 2000);
+  expect("100 vram_kb", st.vram_kb, 2048 + 1024);
+
+  // Only the legacy drm-memory- keys
+  st = walk(proc_fd, 200);
+  expect("200 drm_fds", (unsigned long long)st.drm_fds, 1);
+  expect("200 gpu_ns", st.gpu_ns, 10);
+  expect("200 vram_kb", st.vram_kb, 512);
+
+  // No fd directory: not walked
+  st = walk(proc_fd, 300);
+  expect("300 drm_fds", (unsigned long long)(st.drm_fds + 1), 0);
+
+  close(proc_fd);
+  if (failures) return 1;
+  printf("drm fdinfo: ok\n");
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Runs the nvidia-smi coprocess against tests/fixtures/nvidia-smi, so it
+// runs without a GPU: several GPUs per pass, [N/A] fields and a restart
+// after the stub exits. Built by `make check`.
+#include "../gpu.c"
+
+static int failures;
+
+static void expect(const char *what, float got, float want) {
+  if (got == want) return;
+  fprintf(stderr, "FAIL %s: got %.1f, want %.1f\n", what, got, want);
+  failures++;
+}
+
+// Sample until GPU 0 reports util, or give up after two seconds
+static int sample_until(GpuSample *gpus, float util0) {
+  int count = 0;
+  for (int i = 0; i < 200; i++) {
+    count = gpu_sample(gpus, MAX_GPUS);
+    if (count == 3 && gpus[0].util == util0) break;
+    usleep(10000);
+  }
+  return count;
+}
+
+int main(int argc, char *argv[]) {
+  const char *stub = argc > 1 ? argv[1] : "tests/fixtures/nvidia-smi";
+  char runs[] = "/tmp/vitals-nvsmi-XXXXXX";
+  int fd = mkstemp(runs);
+  if (fd < 0) {
+    perror(runs);
+    return 1;
+  }
+  close(fd);
+  setenv("VITALS_NVIDIA_SMI", stub, 1);
+  setenv("NVSMI_STUB_RUNS", runs, 1);
+
+  GpuSample gpus[MAX_GPUS];
+  if (!gpu_available()) {
+    fprintf(stderr, "FAIL gpu_available\n");
+    return 1;
+  }
+
+  // First run: util and memory of each GPU; [N/A] leaves a value unknown
+  int count = sample_until(gpus, 12);
+  expect("first run gpus", (float)count, 3);
+  expect("first run nvidia0 util", gpus[0].util, 12);
+  expect("first run nvidia0 vram", gpus[0].vram, 25);
+  expect("first run nvidia1 util", gpus[1].util, -1);
+  expect("first run nvidia1 vram", gpus[1].vram, 25);
+  expect("first run nvidia2 util", gpus[2].util, 50);
+  expect("first run nvidia2 vram", gpus[2].vram, -1);
+
+  // The stub has exited; pretend the restart delay passed
+  for (int i = 0; i < 200 && nvsmi.pid > 0; i++) {
+    gpu_sample(gpus, MAX_GPUS);
+    usleep(10000);
+  }
+  nvsmi.started.tv_sec -= NVSMI_RESTART_MS / 1000 + 1;
+  count = sample_until(gpus, 90);
+  expect("restart gpus", (float)count, 3);
+  expect("restart nvidia0 util", gpus[0].util, 90);
+  expect("restart nvidia0 vram", gpus[0].vram, 50);
+  expect("restart nvidia1 util", gpus[1].util, -1);
+  expect("restart nvidia1 vram", gpus[1].vram, 75);
+  expect("restart nvidia2 util", gpus[2].util, 100);
+  expect("restart nvidia2 vram", gpus[2].vram, 50);
+
+  gpu_shutdown();
+  unlink(runs);
+  if (failures) return 1;
+  printf("nvidia-smi: ok\n");
+  return 0;
+}
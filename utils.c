@@ -1,59 +1,164 @@
 
 #include "utils.h"
+#include <string.h>
 
-Node *node_create(void *value) {
-  Node *tmp = (Node *)malloc(sizeof(Node));
-  tmp->value = value;
-  tmp->next = NULL;
-  return tmp;
+int series_init(Series *series, int cap) {
+  series->values = NULL;
+  series->cap = 0;
+  series->head = 0;
+  series->count = 0;
+  return series_resize(series, cap);
 }
 
-List *list_create() {
-  List *tmp = (List *)malloc(sizeof(List));
-  tmp->first = NULL;
-  tmp->last = NULL;
-  tmp->count = 0;
-  return tmp;
-}
+// Change the capacity, keeping the newest samples that still fit.
+// Only called when the terminal width changes.
+int series_resize(Series *series, int cap) {
+  if (cap < 0) cap = 0;
+  if (cap == series->cap) return 1;
+
+  long *values = NULL;
+  if (cap > 0) {
+    values = (long *)malloc((size_t)cap * sizeof(long));
+    if (!values) return 0;
+  }
 
-void list_append_int(List *list, int num){
-  int *value = (int *)malloc(sizeof(int));
-  *value=num;
-  list_append(list,value);
+  int keep = series->count < cap ? series->count : cap;
+  for (int i = 0; i < keep; i++) {
+    values[i] = series_at(series, series->count - keep + i);
+  }
+
+  free(series->values);
+  series->values = values;
+  series->cap = cap;
+  series->head = 0;
+  series->count = keep;
+  return 1;
 }
 
-void list_append_u_long(List *list, unsigned long num){
-  unsigned long *value = (unsigned long *)malloc(sizeof(unsigned long));
-  *value=num;
-  list_append(list,value);
+// Copy src into dst, reusing dst's buffer unless the capacity differs
+int series_copy(Series *dst, const Series *src) {
+  if (dst->cap != src->cap) {
+    long *values = NULL;
+    if (src->cap > 0) {
+      values = (long *)realloc(dst->values, (size_t)src->cap * sizeof(long));
+      if (!values) return 0;
+    } else {
+      free(dst->values);
+    }
+    dst->values = values;
+    dst->cap = src->cap;
+  }
+  if (src->cap > 0) memcpy(dst->values, src->values, (size_t)src->cap * sizeof(long));
+  dst->head = src->head;
+  dst->count = src->count;
+  return 1;
 }
 
-void list_append(List *list, void *value) {
-  Node *node = node_create(value);
-  if (list->count == 0) {
-    list->first = node;
+void series_push(Series *series, long value) {
+  if (series->cap == 0) return;
+  if (series->count < series->cap) {
+    series->values[(series->head + series->count) % series->cap] = value;
+    series->count++;
   } else {
-    list->last->next = node;
+    series->values[series->head] = value;
+    series->head = (series->head + 1) % series->cap;
+  }
+}
+
+// Drop all samples but keep the buffer
+void series_clear(Series *series) {
+  series->head = 0;
+  series->count = 0;
+}
+
+void series_free(Series *series) {
+  free(series->values);
+  series->values = NULL;
+  series->cap = 0;
+  series->head = 0;
+  series->count = 0;
+}
+
+int heatmap_init(Heatmap *map, int rows, int cap) {
+  map->cells = NULL;
+  map->rows = 0;
+  map->cap = 0;
+  map->head = 0;
+  map->count = 0;
+  return heatmap_resize(map, rows, cap);
+}
+
+// Change the capacity, keeping the newest columns that still fit. The
+// history is dropped when the row count changes (CPUs going on/offline).
+int heatmap_resize(Heatmap *map, int rows, int cap) {
+  if (rows < 0) rows = 0;
+  if (cap < 0) cap = 0;
+  if (rows == map->rows && cap == map->cap) return 1;
+
+  unsigned char *cells = NULL;
+  if (rows > 0 && cap > 0) {
+    cells = (unsigned char *)malloc((size_t)rows * (size_t)cap);
+    if (!cells) return 0;
+  }
+
+  int keep = rows == map->rows ? (map->count < cap ? map->count : cap) : 0;
+  for (int i = 0; i < keep; i++) {
+    memcpy(cells + (size_t)i * rows, heatmap_column(map, map->count - keep + i), (size_t)rows);
   }
-  list->last = node;
-  list->count++;
+
+  free(map->cells);
+  map->cells = cells;
+  map->rows = rows;
+  map->cap = cap;
+  map->head = 0;
+  map->count = keep;
+  return 1;
+}
+
+// Copy src into dst, reusing dst's buffer unless the size differs
+int heatmap_copy(Heatmap *dst, const Heatmap *src) {
+  size_t size = (size_t)src->rows * (size_t)src->cap;
+  if ((size_t)dst->rows * (size_t)dst->cap != size) {
+    unsigned char *cells = NULL;
+    if (size > 0) {
+      cells = (unsigned char *)realloc(dst->cells, size);
+      if (!cells) return 0;
+    } else {
+      free(dst->cells);
+    }
+    dst->cells = cells;
+  }
+  if (size > 0) memcpy(dst->cells, src->cells, size);
+  dst->rows = src->rows;
+  dst->cap = src->cap;
+  dst->head = src->head;
+  dst->count = src->count;
+  return 1;
 }
 
-void list_free(List *list) {
-  Node *node = list->first;
-  Node *nextNode = NULL;
-  while (node != NULL) {
-    nextNode = node->next;
-    free(node->value);
-    free(node);
-    node = nextNode;
+void heatmap_push(Heatmap *map, const unsigned char *column) {
+  if (map->cap == 0 || map->rows == 0) return;
+  int idx;
+  if (map->count < map->cap) {
+    idx = (map->head + map->count) % map->cap;
+    map->count++;
+  } else {
+    idx = map->head;
+    map->head = (map->head + 1) % map->cap;
   }
-  free(list);
+  memcpy(map->cells + (size_t)idx * map->rows, column, (size_t)map->rows);
 }
 
-int node_get_int(Node *node){
-  return *((int *)node->value);
+void heatmap_clear(Heatmap *map) {
+  map->head = 0;
+  map->count = 0;
 }
-unsigned long node_get_u_long(Node *node){
-  return *((unsigned long *)node->value);
+
+void heatmap_free(Heatmap *map) {
+  free(map->cells);
+  map->cells = NULL;
+  map->rows = 0;
+  map->cap = 0;
+  map->head = 0;
+  map->count = 0;
 }
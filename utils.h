@@ -3,25 +3,50 @@
 #define UTILS_H
 #include <stdlib.h>
 
-typedef struct node {
-  void *value;
-  struct node *next;
-} Node;
-
-typedef struct list {
-  Node *first;
-  Node *last;
+// Fixed-capacity ring of samples. Once full, each push overwrites the
+// oldest value, so steady-state sampling never allocates.
+typedef struct series {
+  long *values;
+  int cap;
+  int head;  // index of the oldest sample
   int count;
-} List;
+} Series;
+
+int series_init(Series *series, int cap);
+int series_resize(Series *series, int cap);
+int series_copy(Series *dst, const Series *src);
+void series_push(Series *series, long value);
+void series_clear(Series *series);
+void series_free(Series *series);
 
-Node *node_create(void *value);
+// i = 0 is the oldest sample, i = count - 1 the newest
+static inline long series_at(const Series *series, int i) {
+  int idx = series->head + i;
+  if (idx >= series->cap) idx -= series->cap;
+  return series->values[idx];
+}
+
+// Ring of sample columns with one 0..100 cell per row (e.g. per core),
+// laid out column after column. Same push/overwrite rules as Series.
+typedef struct heatmap {
+  unsigned char *cells;
+  int rows;
+  int cap;
+  int head;  // index of the oldest column
+  int count;
+} Heatmap;
 
-List *list_create();
+int heatmap_init(Heatmap *map, int rows, int cap);
+int heatmap_resize(Heatmap *map, int rows, int cap);
+int heatmap_copy(Heatmap *dst, const Heatmap *src);
+void heatmap_push(Heatmap *map, const unsigned char *column);
+void heatmap_clear(Heatmap *map);
+void heatmap_free(Heatmap *map);
 
-void list_append(List *list, void *value);
-void list_append_int(List *list, int num);
-void list_append_u_long(List *list, unsigned long num);
-void list_free(List *list);
-int node_get_int(Node *node);
-unsigned long node_get_u_long(Node *node);
+// i = 0 is the oldest column, i = count - 1 the newest
+static inline const unsigned char *heatmap_column(const Heatmap *map, int i) {
+  int idx = map->head + i;
+  if (idx >= map->cap) idx -= map->cap;
+  return map->cells + (size_t)idx * (size_t)map->rows;
+}
 #endif
@@ -2,16 +2,62 @@
 #include "termbox.h"
 #include "modules.h"
 #include "utils.h"
+#include "snapshot.h"
+#include "shm.h"
+#include "stream.h"
+#include "metrics.h"
+#include "record.h"
 #include <pthread.h>
 #include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/timerfd.h>
 
-#define MAX_DISKS 8
 #define STR_LEN(s) (sizeof(s) - 1) 
 #define APP_NAME " vitals "
 #define APP_VERSION " 0.1.0 "
 #define ALERT_MESSAGE "The terminal is too small."
 #define MIN_WIDTH 80
 #define MIN_HEIGHT 20
+#define DEFAULT_SCAN_WORKERS 4
+#define DEFAULT_DELAY_MS 1000
+#define MIN_DELAY_MS 100
+#define MAX_DELAY_MS 3600000
+// stdout buffer for --stream; flushed once per pass
+#define STREAM_BUFFER (64 * 1024)
+// Viewers look for a new daemon tick this many times per interval
+#define ATTACH_POLLS_PER_TICK 4
+#define ATTACH_MIN_POLL_MS 25
+// Replay seek steps in recorded ticks, and playback speeds as powers of two
+#define REPLAY_SEEK_SHORT 10
+#define REPLAY_SEEK_LONG 300
+#define REPLAY_MIN_SPEED -3
+#define REPLAY_MAX_SPEED 6
+// --trigger without --flight keeps this much
+#define FLIGHT_DEFAULT_MINUTES 10
+#define FLIGHT_MAX_MINUTES 1440
+#define FLIGHT_MAX_TRIGGERS 8
+#define DEFAULT_BENCH_PROCS 16000
+// Process rows sorted beyond the visible window, in pages
+#define PROC_SORT_MARGIN_PAGES 2
+// Cores named in the heatmap title
+#define HOTTEST_CORES 4
+// Narrower per-GPU boxes collapse into one aggregate GPU/VRAM pair
+#define GPU_BOX_MIN_WIDTH 26
+
+// --trigger NAME>VALUE[:SECS]: dump the flight recorder once the series
+// has stayed above VALUE for SECS. Fires again only after dropping back.
+typedef struct {
+  SeriesId series;
+  double above;
+  int hold_ms;
+  struct timespec since; // first pass above, while holding
+  short holding;
+  short fired;
+  const char *rule;
+} FlightTrigger;
 
 // Tabs
 typedef enum { TAB_VITALS = 0, TAB_PROCESSES = 1 } ActiveTab;
@@ -21,7 +67,9 @@ typedef enum {
   PROC_SORT_CPU = 0,
   PROC_SORT_MEM = 1,
   PROC_SORT_RSS = 2,
-  PROC_SORT_PID = 3
+  PROC_SORT_PID = 3,
+  PROC_SORT_GPU = 4,
+  PROC_SORT_VRAM = 5
 } ProcSort;
 
 // Input mode for process tab
@@ -33,16 +81,16 @@ static struct tb_event event = {0};
 char *blocks[8]={"▁","▂","▃","▄","▅","▆","▇","█"};
 char *box[8] = {"┌", "┐", "└", "┘", "─", "│", "┤", "├"};
 
-typedef void (*draw_bars)(List *, int, int, int, int);
+typedef void (*draw_bars)(const Series *, int, int, int, int);
+typedef void (*format_value)(char *, size_t, unsigned long);
 
-typedef enum { BOX, VBOX, HBOX } ContainerType;
+typedef enum { BOX, VBOX, HBOX, HEATMAP } ContainerType;
 
 typedef struct Container {
   ContainerType type;
   union {
     struct { 
-      List *list; 
-      char *title; 
+      SeriesId series; 
       draw_bars draw_func; 
     } box;
     struct { 
@@ -53,34 +101,87 @@ typedef struct Container {
 } Container;
 
 typedef struct {
-  List *cpu_list;
-  List *mem_list;
-  List *gpu_list;
-  List *vram_list;
-  List *net_up_list;
-  List *net_down_list;
-  List *disk_lists[MAX_DISKS];
-  char cpu_title[100];
-  char mem_title[100];
-  char gpu_title[100];
-  char vram_title[100];
-  char net_up_title[100];
-  char net_down_title[100];
-  char disk_titles[MAX_DISKS][100];
-  int disk_count;
-  DiskInfo *disk_info;
+  // Sample history, owned by the stats thread. The renderer only sees
+  // copies of it inside published snapshots.
+  Series history[SERIES_COUNT];
+  int history_width;
+  char titles[SERIES_COUNT][TITLE_LEN];
+  Heatmap core_history;
+  char cores_title[TITLE_LEN];
+  float *core_percs;
+  unsigned char *core_column;
+  int core_cap;
+  int core_count; // cores seen at startup, decides the layout
+  DiskInfo disks[MAX_DISKS];
+  int disk_sampled;
+  int gpu_sampled;
+  char disk_slot_names[MAX_DISKS][DISK_NAME_LEN]; // owner of each disk history slot
+  int uevent_fd;
+  int interval_ms; // sampling period (-d)
+  int tick_fd;     // timerfd firing every interval_ms on absolute deadlines
+  // --daemon publishes every pass into the shm ring instead of snapshots;
+  // --attach rebuilds the history from it instead of collecting
+  short daemon;
+  short attached;
+  volatile short daemon_gone;
+  ShmRing shm;
+  unsigned long long shm_seq; // last daemon tick taken in (attach)
+  StreamFormat stream; // --stream: one record per pass on stdout
+  short headless; // --daemon or --stream: no termbox, no render thread
+  const char *metrics_addr; // --metrics: serve snapshots to Prometheus
+  // --record appends every pass to a file; --replay shows one instead of
+  // collecting. The replay controls are set by the render thread under
+  // data_mutex.
+  const char *record_path;
+  Recorder recorder;
+  int record_error;
+  short replaying;
+  Replay replay;
+  long replay_pos;        // frame shown
+  int64_t replay_time_ns; // when it was recorded
+  long replay_seek;       // frame asked for, -1 if none
+  short replay_paused;
+  int replay_speed;       // log2 of the playback speed
+  // --flight keeps the last minutes of passes in memory, written out on
+  // SIGUSR1 or when a --trigger fires
+  FlightRing flight;
+  int flight_every; // passes per flight frame, 0 when off
+  unsigned long flight_pass;
+  const char *flight_dir;
+  volatile short flight_requested;
+  FlightTrigger triggers[FLIGHT_MAX_TRIGGERS];
+  int trigger_count;
+  MetricsServer metrics;
+  // Latest pass, unrounded, for --stream and the exporter
+  float cpu_usage;
+  float ram_usage;
+  unsigned long net_up;
+  unsigned long net_down;
+  GpuSample gpus[MAX_GPUS];
+  float gpu_util; // averages over the GPUs, -1 without a reading
+  float gpu_vram;
+  ProcTable *proc_table;
+  // Current and previous /proc/stat samples, swapped every pass
+  SysStat sys_stat[2];
+  int sys_stat_cur;
   char active_interface[32];
   short has_gpu;
   volatile short running;
+  // Guards proc_filter and the replay controls (replay_seek, replay_paused,
+  // replay_speed, replay_pos, replay_time_ns), which both threads use, and
+  // the layout while setup_containers() rebuilds it; never held while
+  // collecting
   pthread_mutex_t data_mutex;
-  pthread_cond_t data_updated;
+  // Self-pipe used to wake the render thread (new sample or shutdown)
+  int wake_fds[2];
+  // Self-pipe used to wake the stats thread (more sorted rows or shutdown)
+  int collect_wake_fds[2];
 
   // Process view
   ProcSampleCtx proc_ctx;
-  ProcessInfo *proc_entries;
-  int proc_count;
   int proc_selected;
   int proc_scroll;
+  volatile int proc_rows_wanted; // rows the view wants sorted
   ActiveTab active_tab;
 
   ProcInputMode proc_mode;
@@ -93,93 +194,387 @@ typedef struct {
   Container mem_box;
   Container gpu_box;
   Container vram_box;
+  Container gpu_boxes[MAX_GPUS];
+  Container vram_boxes[MAX_GPUS];
   Container hbox_cpu_mem;
   Container hbox_gpu_mem;
   Container net_up_box;
   Container net_down_box;
   Container hbox_net;
+  Container cores_box;
   Container disk_boxes[MAX_DISKS];
   Container hbox_disks;
   Container vbox_main;
   Container *hbox_cpu_mem_children[2];
-  Container *hbox_gpu_mem_children[2];
+  Container *hbox_gpu_mem_children[MAX_GPUS * 2];
   Container *hbox_net_children[2];
   Container *hbox_disk_children[MAX_DISKS];
-  Container *vbox_children[4];
+  // Disk slots and metric the disk boxes were last laid out for (render thread)
+  int layout_disk_slots[MAX_DISKS];
+  int layout_disk_count;
+  DiskMetric layout_disk_metric;
+  DiskMetric disk_metric; // shown in the disk boxes, cycled with 'd'
+  int layout_gpu_count; // per-GPU boxes laid out, 0 for the aggregate pair
+  Container *vbox_children[5];
 } SharedData;
 
 // Global shared data
 SharedData shared_data;
 
 // Function prototypes
-void draw_box(int x, int y, int x2, int y2, List *list, char *title, draw_bars draw_b);
-void draw_bars_perc(List *list, int width, int height, int min_x, int min_y);
-void draw_scale_bars(List *list, int width, int height, int min_x, int min_y);
-void container_render_vbox(int x, int y, int width, int height, Container *container);
-void container_render_hbox(int x, int y, int width, int height, Container *container);
-void container_render(int x, int y, int width, int height, Container *container);
+void draw_box(int x, int y, int x2, int y2, const Series *series, const char *title, draw_bars draw_b);
+void draw_bars_perc(const Series *series, int width, int height, int min_x, int min_y);
+void draw_scale_bars(const Series *series, int width, int height, int min_x, int min_y);
+void draw_scale_iops(const Series *series, int width, int height, int min_x, int min_y);
+void draw_scale_usec(const Series *series, int width, int height, int min_x, int min_y);
+void draw_scale_count(const Series *series, int width, int height, int min_x, int min_y);
+void draw_heatmap(const Heatmap *map, int width, int height, int min_x, int min_y);
+void container_render_vbox(const Snapshot *snap, int x, int y, int width, int height, Container *container);
+void container_render_hbox(const Snapshot *snap, int x, int y, int width, int height, Container *container);
+void container_render(const Snapshot *snap, int x, int y, int width, int height, Container *container);
 void *stats_collection_thread(void *arg);
+void *attach_thread(void *arg);
+void *replay_thread(void *arg);
 void *render_thread(void *arg);
 void setup_containers();
 void cleanup_resources();
 void handle_signal(int signal);
-void list_trim(List *list, int width);
+void handle_flight_signal(int signal);
+void notify_render();
+void notify_collector();
+static void publish_latest();
+static void shm_publish();
+static void stream_publish();
+static void record_publish();
+static int parse_trigger(const char *rule, FlightTrigger *trigger);
+static void flight_publish();
+static void flight_dump_now(const char *reason);
+static short replay_handle_key(uint16_t key, uint32_t ch);
+static short collector_wait();
+static int tick_set(int ms);
+static void collect_cores(const SysStat *prev, const SysStat *cur);
+static void collect_gpus();
+static void collect_disks();
+static void layout_gpus(const Snapshot *snap, int width);
+static void layout_disks(const Snapshot *snap);
 
 static void draw_tabs(int width, ActiveTab active);
-static void render_process_view(int width, int height);
-static void process_handle_key(uint16_t key, uint32_t ch);
+static void render_process_view(const Snapshot *snap, int width, int height);
+static void process_handle_key(const Snapshot *snap, uint16_t key, uint32_t ch);
+static void process_filter_key(uint16_t key, uint32_t ch);
 static void draw_hline(int x, int y, int w);
+static void render_frame(int width, int height);
+static short handle_event(struct tb_event *ev, int width, const Snapshot *snap);
+
+static void usage(const char *prog) {
+  printf("Usage: %s [options]\n"
+         "  -d, --delay SECS       sampling interval, down to 0.1 (default: 1)\n"
+         "  -w, --workers N        threads used to read /proc (default: up to %d)\n"
+         "      --daemon           collect without a UI and publish to " SHM_PATH " for viewers\n"
+         "      --attach           show what a running --daemon collects instead of collecting\n"
+         "      --stream=FORMAT    print one jsonl or csv record per interval to stdout, no UI\n"
+         "      --metrics=ADDR     serve Prometheus metrics on [HOST:]PORT (default host 127.0.0.1)\n"
+         "                         or unix:PATH\n"
+         "      --record FILE      collect without a UI and append every interval to FILE\n"
+         "      --replay FILE      play back a recording: Space pause, Left/Right and [ ] seek,\n"
+         "                         , . step, - + speed, g G start/end\n"
+         "      --flight=MIN[:SECS]  keep the last MIN minutes in memory, one frame every SECS\n"
+         "                         (default: every interval); SIGUSR1 writes them out for --replay\n"
+         "      --trigger=RULE     also write them out when RULE holds, e.g. cpu>95:10 for CPU\n"
+         "                         above 95%% for 10 s; names: cpu mem gpu vram net_up net_down\n"
+         "      --flight-dir=DIR   where flight recordings go (default: current directory)\n"
+         "      --bench-scan[=N]   time process scans with up to N extra idle processes and exit\n"
+         "  -h, --help             show this help\n",
+         prog, DEFAULT_SCAN_WORKERS);
+}
 
 int main(int argc, char *argv[]) {
-  // Initialize termbox
-  tb_init();
+  enum { OPT_BENCH_SCAN = 256, OPT_DAEMON, OPT_ATTACH, OPT_STREAM, OPT_METRICS, OPT_RECORD, OPT_REPLAY, OPT_FLIGHT, OPT_TRIGGER, OPT_FLIGHT_DIR };
+  static const struct option long_opts[] = {
+    {"delay", required_argument, NULL, 'd'},
+    {"workers", required_argument, NULL, 'w'},
+    {"bench-scan", optional_argument, NULL, OPT_BENCH_SCAN},
+    {"daemon", no_argument, NULL, OPT_DAEMON},
+    {"attach", no_argument, NULL, OPT_ATTACH},
+    {"stream", required_argument, NULL, OPT_STREAM},
+    {"metrics", required_argument, NULL, OPT_METRICS},
+    {"record", required_argument, NULL, OPT_RECORD},
+    {"replay", required_argument, NULL, OPT_REPLAY},
+    {"flight", required_argument, NULL, OPT_FLIGHT},
+    {"trigger", required_argument, NULL, OPT_TRIGGER},
+    {"flight-dir", required_argument, NULL, OPT_FLIGHT_DIR},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  int scan_workers = ncpu < DEFAULT_SCAN_WORKERS ? (ncpu > 0 ? (int)ncpu : 1) : DEFAULT_SCAN_WORKERS;
+  int bench_procs = -1;
+  shared_data.interval_ms = DEFAULT_DELAY_MS;
+  shared_data.recorder.fd = -1;
+  shared_data.replay.fd = -1;
+  const char *replay_path = NULL;
+  double flight_minutes = 0, flight_secs = 0;
+  shared_data.flight_dir = ".";
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "d:w:h", long_opts, NULL)) != -1) {
+    switch (opt) {
+      case 'd': {
+        char *end;
+        double secs = strtod(optarg, &end);
+        if (end == optarg || *end || secs * 1000 < MIN_DELAY_MS || secs * 1000 > MAX_DELAY_MS) {
+          fprintf(stderr, "%s: delay must be between %.1f and %d seconds\n", argv[0], MIN_DELAY_MS / 1000.0, MAX_DELAY_MS / 1000);
+          return 1;
+        }
+        shared_data.interval_ms = (int)(secs * 1000 + 0.5);
+        break;
+      }
+      case 'w':
+        scan_workers = atoi(optarg);
+        if (scan_workers < 1 || scan_workers > PROC_SCAN_MAX_WORKERS) {
+          fprintf(stderr, "%s: workers must be between 1 and %d\n", argv[0], PROC_SCAN_MAX_WORKERS);
+          return 1;
+        }
+        break;
+      case OPT_BENCH_SCAN:
+        bench_procs = optarg ? atoi(optarg) : DEFAULT_BENCH_PROCS;
+        break;
+      case OPT_DAEMON:
+        shared_data.daemon = 1;
+        break;
+      case OPT_ATTACH:
+        shared_data.attached = 1;
+        break;
+      case OPT_STREAM:
+        shared_data.stream = stream_format(optarg);
+        if (shared_data.stream == STREAM_NONE) {
+          fprintf(stderr, "%s: stream format must be jsonl or csv\n", argv[0]);
+          return 1;
+        }
+        break;
+      case OPT_METRICS:
+        shared_data.metrics_addr = optarg;
+        break;
+      case OPT_RECORD:
+        shared_data.record_path = optarg;
+        break;
+      case OPT_REPLAY:
+        replay_path = optarg;
+        break;
+      case OPT_FLIGHT: {
+        char *end;
+        flight_minutes = strtod(optarg, &end);
+        if (end != optarg && *end == ':') flight_secs = strtod(end + 1, &end);
+        if (end == optarg || *end || flight_minutes <= 0 || flight_minutes > FLIGHT_MAX_MINUTES || flight_secs < 0) {
+          fprintf(stderr, "%s: flight must be MINUTES[:SECS] with up to %d minutes\n", argv[0], FLIGHT_MAX_MINUTES);
+          return 1;
+        }
+        break;
+      }
+      case OPT_TRIGGER:
+        if (shared_data.trigger_count == FLIGHT_MAX_TRIGGERS ||
+            parse_trigger(optarg, &shared_data.triggers[shared_data.trigger_count]) != 0) {
+          fprintf(stderr, "%s: bad trigger '%s' (at most %d of NAME>VALUE[:SECS])\n", argv[0], optarg, FLIGHT_MAX_TRIGGERS);
+          return 1;
+        }
+        shared_data.trigger_count++;
+        break;
+      case OPT_FLIGHT_DIR:
+        shared_data.flight_dir = optarg;
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (bench_procs >= 0) {
+    return proc_bench_scan(bench_procs, scan_workers) == 0 ? 0 : 1;
+  }
+  if (shared_data.trigger_count && flight_minutes == 0) flight_minutes = FLIGHT_DEFAULT_MINUTES;
+  short collects = shared_data.daemon || shared_data.stream || shared_data.metrics_addr || shared_data.record_path ||
+                   flight_minutes > 0;
+  if ((shared_data.attached || replay_path) && (collects || (shared_data.attached && replay_path))) {
+    fprintf(stderr, "%s: --attach and --replay do not collect; they cannot be combined with each other "
+                    "or with --daemon, --stream, --metrics, --record or --flight\n", argv[0]);
+    return 1;
+  }
+  if (flight_minutes > 0) {
+    // Frames land on whole passes
+    shared_data.flight_every = (int)(flight_secs * 1000 / shared_data.interval_ms + 0.5);
+    if (shared_data.flight_every < 1) shared_data.flight_every = 1;
+  }
+  shared_data.headless = shared_data.daemon || shared_data.stream != STREAM_NONE || shared_data.record_path;
+
+  // A viewer takes the interval and layout from the daemon
+  int tick_ms = shared_data.interval_ms;
+  if (shared_data.attached) {
+    if (shm_ring_attach(&shared_data.shm) != 0) {
+      if (errno == EPROTO) fprintf(stderr, "%s: the running vitals daemon is a different version\n", argv[0]);
+      else if (errno == ENOENT) fprintf(stderr, "%s: no vitals daemon running\n", argv[0]);
+      else if (errno == EPERM) fprintf(stderr, "%s: %s was not created by a vitals daemon run by you or root\n", argv[0], SHM_PATH);
+      else fprintf(stderr, "%s: %s: %s\n", argv[0], SHM_PATH, strerror(errno));
+      return 1;
+    }
+    shared_data.interval_ms = shared_data.shm.header->interval_ms;
+    tick_ms = shared_data.interval_ms / ATTACH_POLLS_PER_TICK;
+    if (tick_ms < ATTACH_MIN_POLL_MS) tick_ms = ATTACH_MIN_POLL_MS;
+  }
+  // A replay is paced by the interval it was recorded at
+  if (replay_path) {
+    if (replay_open(&shared_data.replay, replay_path) != 0) {
+      if (errno == EPROTO) fprintf(stderr, "%s: %s: not a recording of this vitals version\n", argv[0], replay_path);
+      else if (errno == ENODATA) fprintf(stderr, "%s: %s: the recording is empty\n", argv[0], replay_path);
+      else fprintf(stderr, "%s: %s: %s\n", argv[0], replay_path, strerror(errno));
+      return 1;
+    }
+    shared_data.replaying = 1;
+    shared_data.replay_seek = 0;
+    shared_data.interval_ms = shared_data.replay.header.interval_ms;
+    tick_ms = shared_data.interval_ms;
+  }
 
-  // Ensure special keys like arrows are decoded into TB_KEY_ARROW_*.
-  // Enable mouse events so tabs can be clicked.
-  tb_set_input_mode(TB_INPUT_ESC | TB_INPUT_MOUSE);
+  if (!shared_data.headless) {
+    // Initialize termbox
+    tb_init();
+
+    // Ensure special keys like arrows are decoded into TB_KEY_ARROW_*.
+    // Enable mouse events so tabs can be clicked.
+    tb_set_input_mode(TB_INPUT_ESC | TB_INPUT_MOUSE);
+  }
   
   // Set up signal handling
   signal(SIGINT, handle_signal);
   signal(SIGTERM, handle_signal);
+  if (shared_data.stream) {
+    // A closed pipe ends the stream through the write error instead
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOFBF, STREAM_BUFFER);
+  }
   
   // Initialize shared data
   pthread_mutex_init(&shared_data.data_mutex, NULL);
-  pthread_cond_init(&shared_data.data_updated, NULL);
+  if (pipe(shared_data.wake_fds) != 0 || pipe(shared_data.collect_wake_fds) != 0) {
+    tb_shutdown();
+    perror("Failed to create wakeup pipe");
+    return 1;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(shared_data.wake_fds[i], F_SETFL, O_NONBLOCK);
+    fcntl(shared_data.wake_fds[i], F_SETFD, FD_CLOEXEC);
+    fcntl(shared_data.collect_wake_fds[i], F_SETFL, O_NONBLOCK);
+    fcntl(shared_data.collect_wake_fds[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  shared_data.tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (shared_data.tick_fd < 0 || tick_set(tick_ms) != 0) {
+    tb_shutdown();
+    perror("Failed to create sampling timer");
+    return 1;
+  }
+  gpu_set_interval(shared_data.interval_ms);
   shared_data.running = 1;
 
   shared_data.active_tab = TAB_VITALS;
-  shared_data.proc_entries = NULL;
-  shared_data.proc_count = 0;
   shared_data.proc_selected = 0;
   shared_data.proc_scroll = 0;
   shared_data.proc_mode = PROC_MODE_NORMAL;
   shared_data.proc_filter[0] = '\0';
   shared_data.proc_filter_prev[0] = '\0';
   shared_data.proc_sort = PROC_SORT_CPU;
-  proc_init_ctx(&shared_data.proc_ctx);
-  
-  // Create lists
-  shared_data.cpu_list = list_create();
-  shared_data.mem_list = list_create();
-  shared_data.gpu_list = list_create();
-  shared_data.vram_list = list_create();
-  shared_data.net_up_list = list_create();
-  shared_data.net_down_list = list_create();
-
-  // Detect GPU once (layout stays stable)
-  shared_data.has_gpu = gpu_available();
-  
-  // Get active network interface
-  get_active_interface(shared_data.active_interface, sizeof(shared_data.active_interface));
-  
-  // Initialize disk info
-  shared_data.disk_info = NULL;
-  shared_data.disk_count = 0;
-  get_disk_info(&shared_data.disk_count);
-  if (shared_data.disk_count > MAX_DISKS) shared_data.disk_count = MAX_DISKS;
-  
-  for (int i = 0; i < shared_data.disk_count; i++) {
-    shared_data.disk_lists[i] = list_create();
+  snapshot_pool_init();
+
+  if (shared_data.attached) {
+    shared_data.proc_ctx.proc_fd = -1;
+    shared_data.uevent_fd = -1;
+    shared_data.has_gpu = (short)shared_data.shm.header->has_gpu;
+    shared_data.core_count = shared_data.shm.header->core_count;
+  } else if (shared_data.replaying) {
+    shared_data.proc_ctx.proc_fd = -1;
+    shared_data.uevent_fd = -1;
+    shared_data.has_gpu = (short)shared_data.replay.header.has_gpu;
+    shared_data.core_count = shared_data.replay.header.core_count;
+  } else {
+    proc_init_ctx(&shared_data.proc_ctx);
+    proc_set_workers(&shared_data.proc_ctx, scan_workers);
+
+    // Detect GPU once (layout stays stable)
+    shared_data.has_gpu = gpu_available();
+    // Per-process GPU columns come from DRM fdinfo
+    proc_set_drm_usage(&shared_data.proc_ctx, shared_data.has_gpu);
+
+    // Get active network interface
+    get_active_interface(shared_data.active_interface, sizeof(shared_data.active_interface));
+
+    // First /proc/stat sample; also tells whether there are cores to map
+    sysstat_read(&shared_data.sys_stat[0]);
+    shared_data.core_count = shared_data.sys_stat[0].cpu_count;
+
+    // Disk inventory is built once and then only on hotplug
+    shared_data.uevent_fd = disk_uevent_open();
+    disk_stats_update();
+    disk_inventory_refresh();
+  }
+
+  // Create history buffers, one sample per terminal column. Headless
+  // modes only keep the sample of the current pass.
+  shared_data.history_width = shared_data.headless ? 1 : tb_width();
+  for (int i = 0; i < SERIES_COUNT; i++) {
+    series_init(&shared_data.history[i], shared_data.history_width);
+  }
+  heatmap_init(&shared_data.core_history, shared_data.core_count, shared_data.history_width);
+
+  if (shared_data.flight_every) {
+    int frame_ms = shared_data.flight_every * shared_data.interval_ms;
+    int frames = (int)(flight_minutes * 60000 / frame_ms);
+    // Sized once for today's process count; a busier host keeps less
+    int procs = proc_count();
+    if (flight_init(&shared_data.flight, frames > 0 ? frames : 1, procs > 0 ? procs : 0, frame_ms, shared_data.core_count,
+                    shared_data.has_gpu) != 0) {
+      tb_shutdown();
+      fprintf(stderr, "%s: flight recorder: %s\n", argv[0], strerror(errno));
+      cleanup_resources();
+      return 1;
+    }
+    signal(SIGUSR1, handle_flight_signal);
+  }
+
+  if (shared_data.metrics_addr && metrics_start(&shared_data.metrics, shared_data.metrics_addr) != 0) {
+    int err = errno;
+    tb_shutdown();
+    fprintf(stderr, "%s: --metrics %s: %s\n", argv[0], shared_data.metrics_addr, strerror(err));
+    cleanup_resources();
+    return 1;
+  }
+
+  if (shared_data.headless) {
+    if (shared_data.daemon && shm_ring_create(&shared_data.shm, shared_data.interval_ms, shared_data.core_count, shared_data.has_gpu) != 0) {
+      if (errno == EBUSY) fprintf(stderr, "%s: another vitals daemon is running\n", argv[0]);
+      else if (errno == EPERM) fprintf(stderr, "%s: %s exists and is not this user's vitals ring\n", argv[0], SHM_PATH);
+      else fprintf(stderr, "%s: %s: %s\n", argv[0], SHM_PATH, strerror(errno));
+      shared_data.daemon = 0;
+      cleanup_resources();
+      return 1;
+    }
+    if (shared_data.record_path && rec_create(&shared_data.recorder, shared_data.record_path, shared_data.interval_ms,
+                                              shared_data.core_count, shared_data.has_gpu) != 0) {
+      if (errno == EBUSY) fprintf(stderr, "%s: %s: another vitals is recording to it\n", argv[0], shared_data.record_path);
+      else if (errno == EPROTO) fprintf(stderr, "%s: %s: not a recording this run can extend (another version, interval or machine)\n", argv[0], shared_data.record_path);
+      else fprintf(stderr, "%s: %s: %s\n", argv[0], shared_data.record_path, strerror(errno));
+      cleanup_resources();
+      return 1;
+    }
+    stats_collection_thread(NULL);
+    cleanup_resources();
+    if (shared_data.record_error) {
+      fprintf(stderr, "%s: %s: %s\n", argv[0], shared_data.record_path, strerror(shared_data.record_error));
+      return 1;
+    }
+    return 0;
   }
   
   // Set up containers for UI layout
@@ -187,7 +582,10 @@ int main(int argc, char *argv[]) {
   
   // Create threads
   pthread_t stats_thread, ui_thread;
-  pthread_create(&stats_thread, NULL, stats_collection_thread, NULL);
+  void *(*collector)(void *) = stats_collection_thread;
+  if (shared_data.attached) collector = attach_thread;
+  else if (shared_data.replaying) collector = replay_thread;
+  pthread_create(&stats_thread, NULL, collector, NULL);
   pthread_create(&ui_thread, NULL, render_thread, NULL);
   
   // Wait for threads to finish
@@ -196,211 +594,925 @@ int main(int argc, char *argv[]) {
   
   // Clean up resources
   cleanup_resources();
+  if (shared_data.daemon_gone) {
+    fprintf(stderr, "%s: the vitals daemon exited\n", argv[0]);
+    return 1;
+  }
   
   return 0;
 }
 
-// Stats collection thread
+// History holds one sample per column; only reallocate on resize
+static void history_fit(int width) {
+  if (width == shared_data.history_width) return;
+  for (int i = 0; i < SERIES_COUNT; i++) series_resize(&shared_data.history[i], width);
+  heatmap_resize(&shared_data.core_history, shared_data.core_history.rows, width);
+  shared_data.history_width = width;
+}
+
+// Stats collection thread.
+// Collects into thread-private state and publishes a finished snapshot at
+// the end of each pass, so the renderer never waits on a slow collector.
 void *stats_collection_thread(void *arg) {
   while (shared_data.running) {
-    pthread_mutex_lock(&shared_data.data_mutex);
+    if (!shared_data.headless) history_fit(tb_width());
+    // Headless series hold only what this pass pushes
+    for (int i = 0; shared_data.headless && i < SERIES_COUNT; i++) series_clear(&shared_data.history[i]);
+
+    // One /proc/stat parse per pass feeds every CPU consumer
+    shared_data.sys_stat_cur ^= 1;
+    SysStat *stat = &shared_data.sys_stat[shared_data.sys_stat_cur];
+    const SysStat *prev_stat = &shared_data.sys_stat[shared_data.sys_stat_cur ^ 1];
+    sysstat_read(stat);
 
     // Collect CPU and memory usage
-    float cpu_usage = cpu_perc();
+    float cpu_usage = cpu_perc(prev_stat, stat);
     float ram_usage = mem_perc();
-    list_append_int(shared_data.cpu_list, (int) cpu_usage);
-    list_append_int(shared_data.mem_list, (int) ram_usage);
+    series_push(&shared_data.history[SERIES_CPU], (int) cpu_usage);
+    series_push(&shared_data.history[SERIES_MEM], (int) ram_usage);
+    sprintf(shared_data.titles[SERIES_CPU], "Cpu: %.1f%%", cpu_usage);
+    sprintf(shared_data.titles[SERIES_MEM], "Ram: %.1f%%", ram_usage);
+    shared_data.cpu_usage = cpu_usage;
+    shared_data.ram_usage = ram_usage;
+    collect_cores(prev_stat, stat);
 
     // Collect GPU usage if available
-    if (shared_data.has_gpu) {
-      float gpu_usage = gpu_perc();
-      float vram_usage = vram_perc();
-
-      list_append_int(shared_data.gpu_list, gpu_usage >= 0 ? (int)gpu_usage : 0);
-      list_append_int(shared_data.vram_list, vram_usage >= 0 ? (int)vram_usage : 0);
-
-      if (gpu_usage >= 0) sprintf(shared_data.gpu_title, "Gpu: %.1f%%", gpu_usage);
-      else sprintf(shared_data.gpu_title, "Gpu: N/A");
-
-      if (vram_usage >= 0) sprintf(shared_data.vram_title, "Vram: %.1f%%", vram_usage);
-      else sprintf(shared_data.vram_title, "Vram: N/A");
-    }
+    if (shared_data.has_gpu) collect_gpus();
     
     // Collect network stats
     unsigned long download_speed, upload_speed;
     get_network_speed(&download_speed, &upload_speed, shared_data.active_interface);
-    list_append_u_long(shared_data.net_up_list, upload_speed);
-    list_append_u_long(shared_data.net_down_list, download_speed);
-    
-    // Update titles
-    sprintf(shared_data.cpu_title, "Cpu: %.1f%%", cpu_usage);
-    sprintf(shared_data.mem_title, "Ram: %.1f%%", ram_usage);
-    
+    series_push(&shared_data.history[SERIES_NET_UP], (long)upload_speed);
+    series_push(&shared_data.history[SERIES_NET_DOWN], (long)download_speed);
+    shared_data.net_up = upload_speed;
+    shared_data.net_down = download_speed;
+
     char speed_str[16];
     format_speed(speed_str, sizeof(speed_str), upload_speed);
-    sprintf(shared_data.net_up_title, "N. up: %s", speed_str);
+    sprintf(shared_data.titles[SERIES_NET_UP], "N. up: %s", speed_str);
     format_speed(speed_str, sizeof(speed_str), download_speed);
-    sprintf(shared_data.net_down_title, "N. down: %s", speed_str);
+    sprintf(shared_data.titles[SERIES_NET_DOWN], "N. down: %s", speed_str);
     
-    // Collect disk stats
-    if (shared_data.disk_info) free_disk_info(shared_data.disk_info);
-    shared_data.disk_info = get_disk_info(&shared_data.disk_count);
-    if (shared_data.disk_count > MAX_DISKS) shared_data.disk_count = MAX_DISKS;
-    
-    for (int i = 0; i < shared_data.disk_count; i++) {
-      list_append_int(shared_data.disk_lists[i], (int)shared_data.disk_info[i].busy_percent);
-      sprintf(shared_data.disk_titles[i], "%s (%s): %.2f%%", 
-              shared_data.disk_info[i].device_name, 
-              shared_data.disk_info[i].disk_type, 
-              shared_data.disk_info[i].busy_percent);
-    }
-    int max_width = tb_width();
-
-    // Trim the lists
-    list_trim(shared_data.cpu_list, max_width); 
-    list_trim(shared_data.mem_list, max_width); 
-    if (shared_data.has_gpu) {
-      list_trim(shared_data.gpu_list, max_width);
-      list_trim(shared_data.vram_list, max_width);
-    }
-    list_trim(shared_data.net_up_list, max_width); 
-    list_trim(shared_data.net_down_list, max_width); 
-    for (int i = 0; i < shared_data.disk_count; i++) {
-      list_trim(shared_data.disk_lists[i], max_width); 
-    }
+    collect_disks();
     
     // Process list (only sample when on process tab to reduce work)
-    if (shared_data.active_tab == TAB_PROCESSES) {
+    proc_table_unref(shared_data.proc_table);
+    shared_data.proc_table = NULL;
+    // Sampled while shown, and on every pass for whatever keeps them
+    short want_procs = shared_data.active_tab == TAB_PROCESSES || shared_data.daemon || shared_data.metrics_addr ||
+                       shared_data.record_path || shared_data.flight_every;
+    if (want_procs) {
+      char filter[sizeof(shared_data.proc_filter)];
+      pthread_mutex_lock(&shared_data.data_mutex);
+      memcpy(filter, shared_data.proc_filter, sizeof(filter));
+      pthread_mutex_unlock(&shared_data.data_mutex);
+
       // apply selected sort mode before sampling
       proc_set_sort_mode((int)shared_data.proc_sort);
 
-      if (shared_data.proc_entries) {
-        proc_free(shared_data.proc_entries);
-        shared_data.proc_entries = NULL;
-        shared_data.proc_count = 0;
-      }
-      ProcessInfo *plist = NULL;
-      int pcount = 0;
-      if (proc_list(&plist, &pcount, &shared_data.proc_ctx, shared_data.proc_filter) == 0) {
-        shared_data.proc_entries = plist;
-        shared_data.proc_count = pcount;
-        if (shared_data.proc_selected >= shared_data.proc_count) shared_data.proc_selected = shared_data.proc_count - 1;
-        if (shared_data.proc_selected < 0) shared_data.proc_selected = 0;
+      // Only the rows the view can reach soon are sorted now. Viewers sort
+      // their own copy and the exporter picks its top rows itself; the
+      // daemon sorts further only when the ring cannot take every row.
+      int limit = 1;
+      if (!shared_data.headless) {
+        limit = shared_data.proc_rows_wanted;
+        if (limit <= 0) limit = tb_height() * (1 + PROC_SORT_MARGIN_PAGES);
       }
+
+      if (proc_list(&shared_data.proc_table, &shared_data.proc_ctx, stat, filter, limit) != 0)
+        shared_data.proc_table = NULL;
     }
 
-    // Signal that new data is available
-    pthread_cond_signal(&shared_data.data_updated);
-    pthread_mutex_unlock(&shared_data.data_mutex);
+    if (shared_data.daemon) shm_publish();
+    if (shared_data.stream) stream_publish();
+    if (shared_data.record_path) record_publish();
+    if (shared_data.flight_every) flight_publish();
+    // Scrapes are answered from the published snapshot
+    if (!shared_data.headless || shared_data.metrics_addr) publish_latest();
 
-    // Sleep for 1 second before collecting stats again
-    usleep(1000000);
+    collector_wait();
   }
 
   return NULL;
 }
 
-// Rendering and event handling thread
-void *render_thread(void *arg) {
-  int width = 0, height = 0;
+// Same handover as assign_disk_slots(): a slot's new disk starts empty
+static void disk_slots_take(const ShmStateHead *state) {
+  for (int i = 0; i < state->disk_count; i++) {
+    int slot = state->disks[i].slot;
+    if (slot < 0 || slot >= MAX_DISKS || strcmp(shared_data.disk_slot_names[slot], state->disks[i].device_name) == 0) continue;
+    strcpy(shared_data.disk_slot_names[slot], state->disks[i].device_name);
+    for (int m = 0; m < DISK_METRIC_COUNT; m++) series_clear(&shared_data.history[DISK_SERIES(slot, m)]);
+  }
+}
 
+// Push one recorded tick into the history
+static void sample_take(const ShmSample *sample) {
+  for (int i = 0; i < SERIES_COUNT; i++) {
+    if (sample->values[i] != SHM_NO_SAMPLE) series_push(&shared_data.history[i], sample->values[i]);
+  }
+  if (!sample->core_rows) return;
+  if (sample->core_rows != shared_data.core_history.rows)
+    heatmap_resize(&shared_data.core_history, sample->core_rows, shared_data.history_width);
+  heatmap_push(&shared_data.core_history, sample->cores);
+}
+
+// Show a recorded state; takes over procs
+static void state_take(const ShmStateHead *state, ProcTable *procs) {
+  memcpy(shared_data.titles, state->titles, sizeof(shared_data.titles));
+  memcpy(shared_data.cores_title, state->cores_title, sizeof(shared_data.cores_title));
+  shared_data.gpu_sampled = state->gpu_count;
+  shared_data.disk_sampled = state->disk_count;
+  memcpy(shared_data.disks, state->disks, sizeof(shared_data.disks));
+
+  proc_table_unref(shared_data.proc_table);
+  shared_data.proc_table = procs;
+  if (procs) {
+    proc_set_sort_mode((int)shared_data.proc_sort);
+    int limit = shared_data.proc_rows_wanted;
+    if (limit <= 0) limit = tb_height() * (1 + PROC_SORT_MARGIN_PAGES);
+    proc_table_resort(procs, limit);
+  }
+}
+
+// Take in every daemon tick since the last pass (on attach, as many as the
+// history has room for). Returns 0 when there was nothing new.
+static int attach_pass() {
+  static ShmStateHead state;
+  static ShmSample sample;
+  ShmRing *shm = &shared_data.shm;
+  if (shm_ring_seq(shm) == shared_data.shm_seq) return 0;
+
+  // Process rows are only copied while the process tab shows them
+  char filter[sizeof(shared_data.proc_filter)];
+  pthread_mutex_lock(&shared_data.data_mutex);
+  memcpy(filter, shared_data.proc_filter, sizeof(filter));
+  pthread_mutex_unlock(&shared_data.data_mutex);
+  int want_procs = shared_data.active_tab == TAB_PROCESSES;
+  ProcTable *procs = NULL;
+  unsigned long long seq = shm_state_read(shm, &state, want_procs ? &procs : NULL, filter);
+  if (seq <= shared_data.shm_seq) {
+    proc_table_unref(procs);
+    return 0;
+  }
+
+  disk_slots_take(&state);
+  unsigned long long keep = shared_data.history_width > 0 ? (unsigned long long)shared_data.history_width : 1;
+  if (keep > SHM_RING_LEN - 1) keep = SHM_RING_LEN - 1;
+  unsigned long long first = shared_data.shm_seq + 1;
+  if (seq - first + 1 > keep) first = seq - keep + 1;
+  for (unsigned long long n = first; n <= seq; n++) {
+    if (shm_sample_read(shm, n, &sample) == 0) sample_take(&sample);
+  }
+  shared_data.shm_seq = seq;
+  state_take(&state, procs);
+  return 1;
+}
+
+// Viewer thread for --attach: stands in for the stats thread, but takes
+// the samples from the daemon's ring, so viewers add no collection cost.
+void *attach_thread(void *arg) {
+  (void)arg;
   while (shared_data.running) {
-    int new_width = tb_width();
-    int new_height = tb_height();
+    history_fit(tb_width());
+    if (attach_pass()) {
+      publish_latest();
+    } else if (!shm_ring_alive(&shared_data.shm)) {
+      shared_data.daemon_gone = 1;
+      shared_data.running = 0;
+      notify_render();
+      break;
+    }
+    collector_wait();
+  }
+  return NULL;
+}
 
+// Show frame n: rebuild the history from the frames that lead up to it,
+// reading only their series sections
+static int replay_seek_to(long n, const char *filter) {
+  static ShmSample sample;
+  static ShmStateHead state;
+  ProcTable *procs = NULL;
+  if (replay_read(&shared_data.replay, n, &sample, &state, &procs, filter) != 0) return 0;
+
+  for (int i = 0; i < SERIES_COUNT; i++) series_clear(&shared_data.history[i]);
+  heatmap_clear(&shared_data.core_history);
+  disk_slots_take(&state);
+  long first = n - shared_data.history_width + 1;
+  for (long k = first < 0 ? 0 : first; k <= n; k++) {
+    if (replay_read(&shared_data.replay, k, &sample, NULL, NULL, NULL) == 0) sample_take(&sample);
+  }
+  state_take(&state, procs);
+  return 1;
+}
+
+// Advance one frame, or with step 0 re-read the current one so filter and
+// sort changes show while paused
+static int replay_step(long n, int step, const char *filter) {
+  static ShmSample sample;
+  static ShmStateHead state;
+  ProcTable *procs = NULL;
+  if (replay_read(&shared_data.replay, n, &sample, &state, &procs, filter) != 0) return 0;
+  if (step) {
+    disk_slots_take(&state);
+    sample_take(&sample);
+  }
+  state_take(&state, procs);
+  return 1;
+}
+
+// Player for --replay: stands in for the stats thread and feeds recorded
+// frames through the same history and snapshots
+void *replay_thread(void *arg) {
+  (void)arg;
+  Replay *replay = &shared_data.replay;
+  int speed = 0;
+  short ticked = 0;
+  while (shared_data.running) {
+    history_fit(tb_width());
+
+    char filter[sizeof(shared_data.proc_filter)];
     pthread_mutex_lock(&shared_data.data_mutex);
+    memcpy(filter, shared_data.proc_filter, sizeof(filter));
+    long seek = shared_data.replay_seek;
+    shared_data.replay_seek = -1;
+    short paused = shared_data.replay_paused;
+    int want_speed = shared_data.replay_speed;
+    pthread_mutex_unlock(&shared_data.data_mutex);
 
-    // Check if terminal size changed
-    if (new_width != width || new_height != height) {
-      width = new_width;
-      height = new_height;
+    if (want_speed != speed) {
+      speed = want_speed;
+      int ms = speed >= 0 ? shared_data.interval_ms >> speed : shared_data.interval_ms << -speed;
+      tick_set(ms > 0 ? ms : 1);
     }
 
-    tb_clear();
+    long n = shared_data.replay_pos;
+    int shown = 0;
+    if (seek >= 0) {
+      n = seek;
+      shown = replay_seek_to(n, filter);
+    } else if (ticked && !paused && n + 1 < replay->count) {
+      n++;
+      shown = replay_step(n, 1, filter);
+    } else if (ticked) {
+      shown = replay_step(n, 0, filter);
+    }
 
-    if (width < MIN_WIDTH || height < MIN_HEIGHT) {
-      tb_printf(width / 2 - (STR_LEN(ALERT_MESSAGE) / 2), height / 2, TB_RED, TB_DEFAULT, ALERT_MESSAGE);
-    } else {
-      // Tabs header
-      draw_tabs(width, shared_data.active_tab);
-
-      // Render active tab content below header
-      if (shared_data.active_tab == TAB_VITALS) {
-        container_render(0, 1, width, height - 1, &shared_data.vbox_main);
-      } else {
-        render_process_view(width, height);
+    if (shown) {
+      pthread_mutex_lock(&shared_data.data_mutex);
+      shared_data.replay_pos = n;
+      shared_data.replay_time_ns = replay->frames[n].time_ns;
+      // Stop on the last frame instead of spinning on it
+      if (n + 1 >= replay->count) shared_data.replay_paused = 1;
+      pthread_mutex_unlock(&shared_data.data_mutex);
+      publish_latest();
+    }
+    ticked = collector_wait();
+  }
+  return NULL;
+}
+
+// Replay controls; returns 0 for keys that are not one
+static short replay_handle_key(uint16_t key, uint32_t ch) {
+  long delta = 0;
+  long last = shared_data.replay.count - 1;
+  pthread_mutex_lock(&shared_data.data_mutex);
+  long base = shared_data.replay_seek >= 0 ? shared_data.replay_seek : shared_data.replay_pos;
+  short handled = 1;
+  if (ch == ' ') shared_data.replay_paused = !shared_data.replay_paused;
+  else if (key == TB_KEY_ARROW_LEFT) delta = -REPLAY_SEEK_SHORT;
+  else if (key == TB_KEY_ARROW_RIGHT) delta = REPLAY_SEEK_SHORT;
+  else if (ch == '[') delta = -REPLAY_SEEK_LONG;
+  else if (ch == ']') delta = REPLAY_SEEK_LONG;
+  else if (ch == ',' || ch == '.') {
+    shared_data.replay_paused = 1;
+    delta = ch == ',' ? -1 : 1;
+  } else if (ch == 'g') delta = -base;
+  else if (ch == 'G') delta = last - base;
+  else if (ch == '-') {
+    if (shared_data.replay_speed > REPLAY_MIN_SPEED) shared_data.replay_speed--;
+  } else if (ch == '+' || ch == '=') {
+    if (shared_data.replay_speed < REPLAY_MAX_SPEED) shared_data.replay_speed++;
+  } else handled = 0;
+
+  if (delta) {
+    long target = base + delta;
+    shared_data.replay_seek = target < 0 ? 0 : (target > last ? last : target);
+  }
+  pthread_mutex_unlock(&shared_data.data_mutex);
+  if (handled) notify_collector();
+  return handled;
+}
+
+// One record per pass on stdout; a failed write (reader gone) ends the run
+static void stream_publish() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  StreamRecord rec = {
+    .time = (double)now.tv_sec + now.tv_nsec / 1e9,
+    .cpu = shared_data.cpu_usage,
+    .mem = shared_data.ram_usage,
+    .cores = shared_data.core_percs,
+    .core_count = shared_data.core_percs ? shared_data.core_history.rows : 0,
+    .net_up = shared_data.net_up,
+    .net_down = shared_data.net_down,
+    .gpus = shared_data.gpus,
+    .gpu_count = shared_data.has_gpu ? shared_data.gpu_sampled : 0,
+    .disks = shared_data.disks,
+    .disk_count = shared_data.disk_sampled,
+  };
+  if (stream_write(stdout, shared_data.stream, &rec) != 0 || fflush(stdout) != 0) shared_data.running = 0;
+}
+
+// This pass in the shm ring's form, also used for recordings
+static void sample_fill(ShmSample *sample) {
+  for (int i = 0; i < SERIES_COUNT; i++) {
+    const Series *series = &shared_data.history[i];
+    sample->values[i] = series->count ? series_at(series, series->count - 1) : SHM_NO_SAMPLE;
+  }
+  const Heatmap *cores = &shared_data.core_history;
+  sample->core_rows = cores->count && cores->rows <= SHM_MAX_CORES ? cores->rows : 0;
+  if (sample->core_rows) memcpy(sample->cores, heatmap_column(cores, cores->count - 1), (size_t)sample->core_rows);
+}
+
+static void state_fill(ShmStateHead *state) {
+  memcpy(state->titles, shared_data.titles, sizeof(state->titles));
+  memcpy(state->cores_title, shared_data.cores_title, sizeof(state->cores_title));
+  state->gpu_count = shared_data.gpu_sampled;
+  state->disk_count = shared_data.disk_sampled;
+  memcpy(state->disks, shared_data.disks, sizeof(state->disks));
+}
+
+// Hand this pass to the viewers: one ring sample plus the latest state
+static void shm_publish() {
+  ShmRing *shm = &shared_data.shm;
+  sample_fill(shm_sample_begin(shm));
+  ShmState *state = shm_state_begin(shm);
+  state_fill(&state->head);
+  // Past SHM_MAX_PROCS rows only the top ones are handed over
+  ProcTable *procs = shared_data.proc_table;
+  if (procs && procs->count > SHM_MAX_PROCS) proc_sort_more(procs, SHM_MAX_PROCS);
+  shm_state_set_procs(state, procs);
+  shm_ring_commit(shm);
+}
+
+// Append this pass to the recording; a failed write ends the run
+static void record_publish() {
+  static ShmSample sample;
+  static ShmStateHead state;
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  sample_fill(&sample);
+  state_fill(&state);
+  if (rec_write(&shared_data.recorder, (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec, &sample, &state, shared_data.proc_table) != 0) {
+    shared_data.record_error = errno;
+    shared_data.running = 0;
+  }
+}
+
+static const struct {
+  const char *name;
+  SeriesId series;
+} trigger_names[] = {
+  {"cpu", SERIES_CPU}, {"mem", SERIES_MEM}, {"gpu", SERIES_GPU_ALL},
+  {"vram", SERIES_VRAM_ALL}, {"net_up", SERIES_NET_UP}, {"net_down", SERIES_NET_DOWN},
+};
+
+// The unrounded value behind a trigger's series, -1 when unknown
+static double trigger_value(SeriesId series) {
+  if (series == SERIES_CPU) return shared_data.cpu_usage;
+  if (series == SERIES_MEM) return shared_data.ram_usage;
+  if (series == SERIES_GPU_ALL) return shared_data.gpu_util;
+  if (series == SERIES_VRAM_ALL) return shared_data.gpu_vram;
+  if (series == SERIES_NET_UP) return (double)shared_data.net_up;
+  return (double)shared_data.net_down;
+}
+
+static int parse_trigger(const char *rule, FlightTrigger *trigger) {
+  const char *gt = strchr(rule, '>');
+  if (!gt) return -1;
+  size_t name_len = (size_t)(gt - rule);
+  int found = 0;
+  for (size_t i = 0; i < sizeof(trigger_names) / sizeof(trigger_names[0]); i++) {
+    if (strlen(trigger_names[i].name) != name_len || strncmp(rule, trigger_names[i].name, name_len) != 0) continue;
+    trigger->series = trigger_names[i].series;
+    found = 1;
+  }
+  char *end;
+  double above = strtod(gt + 1, &end);
+  double secs = 0;
+  if (end != gt + 1 && *end == ':') secs = strtod(end + 1, &end);
+  if (!found || end == gt + 1 || *end || above < 0 || secs < 0) return -1;
+  trigger->above = above;
+  trigger->hold_ms = (int)(secs * 1000);
+  trigger->holding = 0;
+  trigger->fired = 0;
+  trigger->rule = rule;
+  return 0;
+}
+
+// Keep every flight_every-th pass and check the triggers on each one
+static void flight_publish() {
+  if (shared_data.flight_pass++ % (unsigned long)shared_data.flight_every == 0) {
+    static ShmSample sample;
+    static ShmStateHead state;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    sample_fill(&sample);
+    state_fill(&state);
+    flight_push(&shared_data.flight, (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec, &sample, &state, shared_data.proc_table);
+  }
+
+  // Held time is measured, not counted in intervals, so late passes add up
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (int i = 0; i < shared_data.trigger_count; i++) {
+    FlightTrigger *trigger = &shared_data.triggers[i];
+    if (trigger_value(trigger->series) <= trigger->above) {
+      trigger->holding = 0;
+      trigger->fired = 0;
+      continue;
+    }
+    if (!trigger->holding) {
+      trigger->holding = 1;
+      trigger->since = now;
+    }
+    double held_ms = (now.tv_sec - trigger->since.tv_sec) * 1000.0 + (now.tv_nsec - trigger->since.tv_nsec) / 1000000.0;
+    if (held_ms >= trigger->hold_ms && !trigger->fired) {
+      trigger->fired = 1;
+      flight_dump_now(trigger->rule);
+    }
+  }
+}
+
+// One file per dump, named by the time with a -N suffix for further dumps
+// in the same second; headless runs say where it went
+static void flight_dump_now(const char *reason) {
+  if (!shared_data.flight.count) return;
+  time_t now = time(NULL);
+  struct tm tm;
+  char stamp[32] = "";
+  if (localtime_r(&now, &tm)) strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/vitals-flight-%s.vr", shared_data.flight_dir, stamp);
+  int rv = flight_dump(&shared_data.flight, path);
+  for (int n = 2; rv != 0 && errno == EEXIST && n < 100; n++) {
+    snprintf(path, sizeof(path), "%s/vitals-flight-%s-%d.vr", shared_data.flight_dir, stamp, n);
+    rv = flight_dump(&shared_data.flight, path);
+  }
+  if (!shared_data.headless) return;
+  if (rv == 0 && shared_data.flight.squeezed)
+    fprintf(stderr, "vitals: %s: flight recorder written to %s; %ld frames were dropped early because the ring was full\n",
+            reason, path, shared_data.flight.squeezed);
+  else if (rv == 0) fprintf(stderr, "vitals: %s: flight recorder written to %s\n", reason, path);
+  else fprintf(stderr, "vitals: %s: %s\n", path, strerror(errno));
+}
+
+// Fill a claimed snapshot slot from the stats thread's latest state
+static void snapshot_fill(Snapshot *snap) {
+  memcpy(snap->titles, shared_data.titles, sizeof(snap->titles));
+  for (int i = 0; i < SERIES_COUNT; i++) {
+    series_copy(&snap->series[i], &shared_data.history[i]);
+  }
+  heatmap_copy(&snap->cores, &shared_data.core_history);
+  memcpy(snap->cores_title, shared_data.cores_title, sizeof(snap->cores_title));
+
+  snap->cpu = shared_data.cpu_usage;
+  snap->mem = shared_data.ram_usage;
+  memcpy(snap->net_interface, shared_data.active_interface, sizeof(snap->net_interface));
+  snap->net_up = shared_data.net_up;
+  snap->net_down = shared_data.net_down;
+  snap->gpu_count = shared_data.gpu_sampled;
+  memcpy(snap->gpus, shared_data.gpus, sizeof(snap->gpus));
+  snap->disk_count = shared_data.disk_sampled;
+  memcpy(snap->disks, shared_data.disks, sizeof(snap->disks));
+
+  ProcTable *table = shared_data.proc_table;
+  if (snap->proc_table != table) {
+    proc_table_unref(snap->proc_table);
+    snap->proc_table = table;
+    if (table) table->refs++;
+  }
+  snap->proc_sorted = table ? table->sorted : 0;
+}
+
+// Per-GPU series plus the aggregate pair (average, with the busiest GPU in
+// the title)
+static void collect_gpus() {
+  GpuSample *gpus = shared_data.gpus;
+  int count = gpu_sample(gpus, MAX_GPUS);
+  float util_sum = 0, util_max = -1, vram_sum = 0, vram_max = -1;
+  int util_n = 0, vram_n = 0;
+
+  for (int i = 0; i < count; i++) {
+    const GpuSample *gpu = &gpus[i];
+    series_push(&shared_data.history[GPU_SERIES(i)], gpu->util >= 0 ? (int)gpu->util : 0);
+    series_push(&shared_data.history[VRAM_SERIES(i)], gpu->vram >= 0 ? (int)gpu->vram : 0);
+
+    if (gpu->util >= 0) {
+      sprintf(shared_data.titles[GPU_SERIES(i)], "Gpu %s: %.1f%%", gpu->name, gpu->util);
+      util_sum += gpu->util;
+      util_n++;
+      if (gpu->util > util_max) util_max = gpu->util;
+    } else sprintf(shared_data.titles[GPU_SERIES(i)], "Gpu %s: N/A", gpu->name);
+
+    if (gpu->vram >= 0) {
+      sprintf(shared_data.titles[VRAM_SERIES(i)], "Vram %s: %.1f%%", gpu->name, gpu->vram);
+      vram_sum += gpu->vram;
+      vram_n++;
+      if (gpu->vram > vram_max) vram_max = gpu->vram;
+    } else sprintf(shared_data.titles[VRAM_SERIES(i)], "Vram %s: N/A", gpu->name);
+  }
+  shared_data.gpu_sampled = count;
+
+  float util = util_n ? util_sum / util_n : -1;
+  float vram = vram_n ? vram_sum / vram_n : -1;
+  shared_data.gpu_util = util;
+  shared_data.gpu_vram = vram;
+  series_push(&shared_data.history[SERIES_GPU_ALL], util >= 0 ? (int)util : 0);
+  series_push(&shared_data.history[SERIES_VRAM_ALL], vram >= 0 ? (int)vram : 0);
+
+  if (util < 0) sprintf(shared_data.titles[SERIES_GPU_ALL], "Gpu: N/A");
+  else if (count == 1) sprintf(shared_data.titles[SERIES_GPU_ALL], "Gpu: %.1f%%", util);
+  else sprintf(shared_data.titles[SERIES_GPU_ALL], "Gpu x%d: avg %.1f%% max %.1f%%", count, util, util_max);
+
+  if (vram < 0) sprintf(shared_data.titles[SERIES_VRAM_ALL], "Vram: N/A");
+  else if (count == 1) sprintf(shared_data.titles[SERIES_VRAM_ALL], "Vram: %.1f%%", vram);
+  else sprintf(shared_data.titles[SERIES_VRAM_ALL], "Vram x%d: avg %.1f%% max %.1f%%", count, vram, vram_max);
+}
+
+// Push one heatmap column and name the hottest cores in the title
+static void collect_cores(const SysStat *prev, const SysStat *cur) {
+  int n = cur->cpu_count;
+  if (n > shared_data.core_cap) {
+    float *percs = (float *)realloc(shared_data.core_percs, (size_t)n * sizeof(float));
+    if (percs) shared_data.core_percs = percs;
+    unsigned char *column = (unsigned char *)realloc(shared_data.core_column, (size_t)n);
+    if (column) shared_data.core_column = column;
+    if (!percs || !column) return;
+    shared_data.core_cap = n;
+  }
+  if (n != shared_data.core_history.rows) {
+    heatmap_resize(&shared_data.core_history, n, shared_data.history_width);
+  }
+  if (n == 0) return;
+
+  cpu_core_percs(prev, cur, shared_data.core_percs);
+
+  // Top HOTTEST_CORES by insertion; O(cores) for a fixed N
+  int hot[HOTTEST_CORES];
+  int hot_count = 0;
+  for (int i = 0; i < n; i++) {
+    float p = shared_data.core_percs[i];
+    shared_data.core_column[i] = p <= 0 ? 0 : (p >= 100 ? 100 : (unsigned char)p);
+
+    int pos = hot_count;
+    while (pos > 0 && shared_data.core_percs[hot[pos - 1]] < p) pos--;
+    if (pos >= HOTTEST_CORES) continue;
+    if (hot_count < HOTTEST_CORES) hot_count++;
+    memmove(&hot[pos + 1], &hot[pos], (size_t)(hot_count - 1 - pos) * sizeof(int));
+    hot[pos] = i;
+  }
+  heatmap_push(&shared_data.core_history, shared_data.core_column);
+
+  char *title = shared_data.cores_title;
+  int len = snprintf(title, TITLE_LEN, "Cores: %d  hottest:", n);
+  for (int i = 0; i < hot_count && len < TITLE_LEN; i++) {
+    len += snprintf(title + len, TITLE_LEN - len, " cpu%d %d%%",
+                    cur->cpus[hot[i]].id, shared_data.core_column[hot[i]]);
+  }
+}
+
+// Give every sampled disk a history slot. Disks keep their slot while
+// present; a hotplugged disk takes a free one with an empty history.
+static void assign_disk_slots(DiskInfo *disks, int count) {
+  int used[MAX_DISKS] = {0};
+  for (int i = 0; i < count; i++) {
+    disks[i].slot = -1;
+    for (int s = 0; s < MAX_DISKS; s++) {
+      if (strcmp(shared_data.disk_slot_names[s], disks[i].device_name) == 0) {
+        disks[i].slot = s;
+        used[s] = 1;
+        break;
       }
+    }
+  }
+  for (int s = 0; s < MAX_DISKS; s++) {
+    if (!used[s]) shared_data.disk_slot_names[s][0] = '\0';
+  }
+  for (int i = 0; i < count; i++) {
+    if (disks[i].slot >= 0) continue;
+    for (int s = 0; s < MAX_DISKS; s++) {
+      if (shared_data.disk_slot_names[s][0]) continue;
+      strcpy(shared_data.disk_slot_names[s], disks[i].device_name);
+      for (int m = 0; m < DISK_METRIC_COUNT; m++) series_clear(&shared_data.history[DISK_SERIES(s, m)]);
+      disks[i].slot = s;
+      break;
+    }
+  }
+}
 
-      // Footer app name and version
-      tb_printf(width - STR_LEN(APP_VERSION), height - 1, TB_DEFAULT | TB_BOLD, TB_DEFAULT, APP_VERSION);
-      tb_printf(0, height - 1, TB_DEFAULT | TB_BOLD, TB_DEFAULT, APP_NAME);
+// One disk metric for a title; "n/a" for a device without diskstats
+static const char *disk_title_value(char *buf, size_t size, const char *format, double value) {
+  if (value < 0) return "n/a";
+  snprintf(buf, size, format, value);
+  return buf;
+}
+
+static void collect_disks() {
+  // One /proc/diskstats pass; /sys/block is only walked again on hotplug
+  int changed = disk_stats_update() > 0;
+  if (disk_uevent_pending(shared_data.uevent_fd)) changed = 1;
+  if (changed) disk_inventory_refresh();
+
+  int disk_count = disk_inventory_sample(shared_data.disks, MAX_DISKS);
+  assign_disk_slots(shared_data.disks, disk_count);
+  shared_data.disk_sampled = disk_count;
+  for (int i = 0; i < disk_count; i++) {
+    const DiskInfo *disk = &shared_data.disks[i];
+    const double *m = disk->metrics;
+    for (int k = 0; k < DISK_METRIC_COUNT; k++) {
+      // Await is kept in microseconds so sub-ms latencies still graph
+      double value = k == DISK_AWAIT ? m[k] * 1000.0 : m[k];
+      series_push(&shared_data.history[DISK_SERIES(disk->slot, k)], value > 0 ? (long)(value + 0.5) : 0);
     }
 
-    pthread_mutex_unlock(&shared_data.data_mutex);
+    char (*titles)[TITLE_LEN] = &shared_data.titles[DISK_SERIES(disk->slot, 0)];
+    char read_str[16] = "n/a", write_str[16] = "n/a", value[DISK_METRIC_COUNT][24];
+    if (m[DISK_READ_BPS] >= 0) format_speed(read_str, sizeof(read_str), (unsigned long)m[DISK_READ_BPS]);
+    if (m[DISK_WRITE_BPS] >= 0) format_speed(write_str, sizeof(write_str), (unsigned long)m[DISK_WRITE_BPS]);
+    sprintf(titles[DISK_BUSY], "%s (%s): %s", disk->device_name, disk->disk_type,
+            disk_title_value(value[DISK_BUSY], sizeof(value[0]), "%.2f%%", m[DISK_BUSY]));
+    sprintf(titles[DISK_READ_BPS], "%s read: %s", disk->device_name, read_str);
+    sprintf(titles[DISK_WRITE_BPS], "%s write: %s", disk->device_name, write_str);
+    sprintf(titles[DISK_READ_IOPS], "%s read: %s", disk->device_name,
+            disk_title_value(value[DISK_READ_IOPS], sizeof(value[0]), "%.0f IO/s", m[DISK_READ_IOPS]));
+    sprintf(titles[DISK_WRITE_IOPS], "%s write: %s", disk->device_name,
+            disk_title_value(value[DISK_WRITE_IOPS], sizeof(value[0]), "%.0f IO/s", m[DISK_WRITE_IOPS]));
+    sprintf(titles[DISK_AWAIT], "%s await: %s", disk->device_name,
+            disk_title_value(value[DISK_AWAIT], sizeof(value[0]), "%.2f ms", m[DISK_AWAIT]));
+    sprintf(titles[DISK_QUEUE], "%s queue: %s", disk->device_name,
+            disk_title_value(value[DISK_QUEUE], sizeof(value[0]), "%.0f", m[DISK_QUEUE]));
+    sprintf(titles[DISK_DISCARD_IOPS], "%s discard: %s", disk->device_name,
+            disk_title_value(value[DISK_DISCARD_IOPS], sizeof(value[0]), "%.0f IO/s", m[DISK_DISCARD_IOPS]));
+    sprintf(titles[DISK_FLUSH_IOPS], "%s flush: %s", disk->device_name,
+            disk_title_value(value[DISK_FLUSH_IOPS], sizeof(value[0]), "%.0f IO/s", m[DISK_FLUSH_IOPS]));
+  }
+}
 
-    tb_present();
-
-    // Non-blocking event read so UI keeps updating.
-    // Small timeout keeps CPU low while still responsive.
-    event.type = 0;
-    tb_peek_event(&event, 50);
-
-    if (event.type == TB_EVENT_MOUSE) {
-      // Click on the top row toggles/selects tabs
-      if (event.y == 0 && event.key == TB_KEY_MOUSE_LEFT) {
-        // Recompute tab hit-boxes exactly like draw_tabs()
-        const char *t1 = "Overview";
-        const char *t2 = "Processes";
-        char left[64];
-        char right[64];
-        snprintf(left, sizeof(left), "[ %s ]", t1);
-        snprintf(right, sizeof(right), "[ %s ]", t2);
-        int tabs_w = (int)strlen(left) + 1 + (int)strlen(right);
-        int start_x = (width > tabs_w) ? (width - tabs_w) / 2 : 0;
-
-        int left_x1 = start_x;
-        int left_x2 = start_x + (int)strlen(left) - 1;
-        int right_x1 = start_x + (int)strlen(left) + 1;
-        int right_x2 = right_x1 + (int)strlen(right) - 1;
-
-        if (event.x >= left_x1 && event.x <= left_x2) {
-          shared_data.active_tab = TAB_VITALS;
-          shared_data.proc_mode = PROC_MODE_NORMAL;
-        } else if (event.x >= right_x1 && event.x <= right_x2) {
-          shared_data.active_tab = TAB_PROCESSES;
-        }
+// If every slot is pinned by readers nothing is published; the history
+// still carries the sample into the next pass.
+static void publish_latest() {
+  Snapshot *snap = snapshot_begin();
+  if (!snap) return;
+  snapshot_fill(snap);
+  snapshot_publish(snap);
+
+  // Signal that new data is available
+  notify_render();
+}
+
+// The view scrolled towards the end of the sorted rows: sort further into
+// the current table and republish it without taking a new sample.
+static void proc_extend_sort() {
+  ProcTable *table = shared_data.proc_table;
+  int wanted = shared_data.proc_rows_wanted;
+  if (!table || wanted <= table->sorted || table->sorted >= table->count) return;
+
+  proc_sort_more(table, wanted);
+  publish_latest();
+}
+
+// Ticks land on now + k * ms regardless of how long a pass takes
+static int tick_set(int ms) {
+  struct itimerspec tick = {0};
+  tick.it_interval.tv_sec = ms / 1000;
+  tick.it_interval.tv_nsec = (long)(ms % 1000) * 1000000L;
+  clock_gettime(CLOCK_MONOTONIC, &tick.it_value);
+  tick.it_value.tv_sec += tick.it_interval.tv_sec;
+  tick.it_value.tv_nsec += tick.it_interval.tv_nsec;
+  if (tick.it_value.tv_nsec >= 1000000000L) {
+    tick.it_value.tv_sec++;
+    tick.it_value.tv_nsec -= 1000000000L;
+  }
+  return timerfd_settime(shared_data.tick_fd, TFD_TIMER_ABSTIME, &tick, NULL);
+}
+
+// Sleep until the next tick, serving requests from the render thread
+// meanwhile. Returns 1 on a tick, 0 when woken early (quit, or a replay
+// control that should apply right away).
+static short collector_wait() {
+  struct pollfd pfds[2] = {
+    {.fd = shared_data.tick_fd, .events = POLLIN},
+    {.fd = shared_data.collect_wake_fds[0], .events = POLLIN},
+  };
+  while (shared_data.running) {
+    if (poll(pfds, 2, -1) <= 0) continue;
+
+    if (pfds[1].revents & POLLIN) {
+      char drain[64];
+      while (read(shared_data.collect_wake_fds[0], drain, sizeof(drain)) > 0);
+      proc_extend_sort();
+      if (shared_data.flight_requested) {
+        shared_data.flight_requested = 0;
+        flight_dump_now("SIGUSR1");
       }
+      if (shared_data.replaying) return 0;
+    }
+    if (pfds[0].revents & POLLIN) {
+      // Expirations missed by a slow pass are dropped, not replayed
+      uint64_t expirations;
+      if (read(shared_data.tick_fd, &expirations, sizeof(expirations)) > 0) return 1;
+    }
+  }
+  return 0;
+}
+
+// Wake the stats thread. Safe to call from signal handlers.
+void notify_collector() {
+  char c = 1;
+  ssize_t rv = write(shared_data.collect_wake_fds[1], &c, 1);
+  (void)rv;
+}
+
+// Wake the render thread. Safe to call from signal handlers.
+void notify_render() {
+  char c = 1;
+  ssize_t rv = write(shared_data.wake_fds[1], &c, 1);
+  (void)rv; // a full pipe already means a wakeup is pending
+}
+
+// Where the replay is, in the footer next to the app name
+static void draw_replay_status(int y) {
+  pthread_mutex_lock(&shared_data.data_mutex);
+  long pos = shared_data.replay_pos;
+  time_t secs = (time_t)(shared_data.replay_time_ns / 1000000000LL);
+  short paused = shared_data.replay_paused;
+  int speed = shared_data.replay_speed;
+  pthread_mutex_unlock(&shared_data.data_mutex);
+
+  struct tm tm;
+  char when[32] = "";
+  if (localtime_r(&secs, &tm)) strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+  char rate[16];
+  if (speed >= 0) snprintf(rate, sizeof(rate), "%dx", 1 << speed);
+  else snprintf(rate, sizeof(rate), "1/%dx", 1 << -speed);
+  tb_printf(STR_LEN(APP_NAME) + 1, y, TB_DEFAULT | TB_BOLD, TB_DEFAULT, "replay %s  %ld/%ld  %s%s",
+            when, pos + 1, shared_data.replay.count, rate, paused ? "  paused" : "");
+}
+
+static void render_frame(int width, int height) {
+  static Snapshot empty_snapshot;
+  Snapshot *pinned = snapshot_acquire();
+  const Snapshot *snap = pinned ? pinned : &empty_snapshot;
+
+  tb_clear();
+
+  if (width < MIN_WIDTH || height < MIN_HEIGHT) {
+    tb_printf(width / 2 - (STR_LEN(ALERT_MESSAGE) / 2), height / 2, TB_RED, TB_DEFAULT, ALERT_MESSAGE);
+  } else {
+    // Tabs header
+    draw_tabs(width, shared_data.active_tab);
+
+    // Render active tab content below header
+    if (shared_data.active_tab == TAB_VITALS) {
+      layout_gpus(snap, width);
+      layout_disks(snap);
+      container_render(snap, 0, 1, width, height - 1, &shared_data.vbox_main);
+    } else {
+      render_process_view(snap, width, height);
+    }
+
+    // Footer app name and version
+    tb_printf(width - STR_LEN(APP_VERSION), height - 1, TB_DEFAULT | TB_BOLD, TB_DEFAULT, APP_VERSION);
+    tb_printf(0, height - 1, TB_DEFAULT | TB_BOLD, TB_DEFAULT, APP_NAME);
+    if (shared_data.replaying) draw_replay_status(height - 1);
+  }
+
+  snapshot_release(pinned);
+
+  tb_present();
+}
 
-      // Click on the process header selects sort column
-      if (shared_data.active_tab == TAB_PROCESSES && shared_data.proc_mode == PROC_MODE_NORMAL &&
-          event.key == TB_KEY_MOUSE_LEFT && event.y == 1) {
-        // Column layout must match render_process_view() header rendering
-        // PID: 0..6, S: 8..9, CPU%: 11..16, MEM%: 18..24, RSS: 26..33
-        if (event.x >= 0 && event.x <= 6) shared_data.proc_sort = PROC_SORT_PID;
-        else if (event.x >= 11 && event.x <= 16) shared_data.proc_sort = PROC_SORT_CPU;
-        else if (event.x >= 18 && event.x <= 24) shared_data.proc_sort = PROC_SORT_MEM;
-        else if (event.x >= 26 && event.x <= 33) shared_data.proc_sort = PROC_SORT_RSS;
+// Apply one input event. Returns 0 when the user asked to quit.
+static short handle_event(struct tb_event *ev, int width, const Snapshot *snap) {
+  if (ev->type == TB_EVENT_MOUSE) {
+    // Click on the top row toggles/selects tabs
+    if (ev->y == 0 && ev->key == TB_KEY_MOUSE_LEFT) {
+      // Recompute tab hit-boxes exactly like draw_tabs()
+      const char *t1 = "Overview";
+      const char *t2 = "Processes";
+      char left[64];
+      char right[64];
+      snprintf(left, sizeof(left), "[ %s ]", t1);
+      snprintf(right, sizeof(right), "[ %s ]", t2);
+      int tabs_w = (int)strlen(left) + 1 + (int)strlen(right);
+      int start_x = (width > tabs_w) ? (width - tabs_w) / 2 : 0;
+
+      int left_x1 = start_x;
+      int left_x2 = start_x + (int)strlen(left) - 1;
+      int right_x1 = start_x + (int)strlen(left) + 1;
+      int right_x2 = right_x1 + (int)strlen(right) - 1;
+
+      if (ev->x >= left_x1 && ev->x <= left_x2) {
+        shared_data.active_tab = TAB_VITALS;
+        shared_data.proc_mode = PROC_MODE_NORMAL;
+      } else if (ev->x >= right_x1 && ev->x <= right_x2) {
+        shared_data.active_tab = TAB_PROCESSES;
       }
-      continue;
     }
 
-    if (event.type != TB_EVENT_KEY) continue;
+    // Click on the process header selects sort column
+    if (shared_data.active_tab == TAB_PROCESSES && shared_data.proc_mode == PROC_MODE_NORMAL &&
+        ev->key == TB_KEY_MOUSE_LEFT && ev->y == 1) {
+      // Column layout must match render_process_view() header rendering
+      // PID: 0..6, S: 8..9, CPU%: 11..16, MEM%: 18..24, RSS: 26..33,
+      // with a GPU also GPU%: 35..40, VRAM: 42..50
+      if (ev->x >= 0 && ev->x <= 6) shared_data.proc_sort = PROC_SORT_PID;
+      else if (ev->x >= 11 && ev->x <= 16) shared_data.proc_sort = PROC_SORT_CPU;
+      else if (ev->x >= 18 && ev->x <= 24) shared_data.proc_sort = PROC_SORT_MEM;
+      else if (ev->x >= 26 && ev->x <= 33) shared_data.proc_sort = PROC_SORT_RSS;
+      else if (shared_data.has_gpu && ev->x >= 35 && ev->x <= 40) shared_data.proc_sort = PROC_SORT_GPU;
+      else if (shared_data.has_gpu && ev->x >= 42 && ev->x <= 50) shared_data.proc_sort = PROC_SORT_VRAM;
+    }
+    return 1;
+  }
+
+  if (ev->type != TB_EVENT_KEY) return 1;
 
-    if (event.ch == 'q' || event.key == TB_KEY_CTRL_C) {
-      shared_data.running = 0;
-      return NULL;
+  if (ev->ch == 'q' || ev->key == TB_KEY_CTRL_C) return 0;
+
+  // Tab switching: Tab is the only way
+  if (ev->key == TB_KEY_TAB) {
+    shared_data.active_tab = (shared_data.active_tab == TAB_VITALS) ? TAB_PROCESSES : TAB_VITALS;
+    if (shared_data.active_tab == TAB_VITALS) shared_data.proc_mode = PROC_MODE_NORMAL;
+    return 1;
+  }
+
+  // Replay controls, except while typing a filter
+  if (shared_data.replaying && shared_data.proc_mode != PROC_MODE_FILTER && replay_handle_key(ev->key, ev->ch)) return 1;
+
+  // Per-tab keys
+  if (shared_data.active_tab == TAB_PROCESSES) {
+    process_handle_key(snap, ev->key, ev->ch);
+  } else if (ev->ch == 'd') {
+    shared_data.disk_metric = (shared_data.disk_metric + 1) % DISK_METRIC_COUNT;
+  }
+  return 1;
+}
+
+// Rendering and event handling thread.
+// Blocks until there is tty input, a resize or a new sample and only
+// redraws when one of those happened.
+void *render_thread(void *arg) {
+  int ttyfd = -1, resizefd = -1;
+  tb_get_fds(&ttyfd, &resizefd);
+
+  struct pollfd fds[3] = {
+    {.fd = ttyfd, .events = POLLIN},
+    {.fd = resizefd, .events = POLLIN},
+    {.fd = shared_data.wake_fds[0], .events = POLLIN},
+  };
+
+  short dirty = 1;
+
+  while (shared_data.running) {
+    if (dirty) {
+      render_frame(tb_width(), tb_height());
+      dirty = 0;
     }
 
-    // Tab switching: Tab is the only way
-    if (event.key == TB_KEY_TAB) {
-      shared_data.active_tab = (shared_data.active_tab == TAB_VITALS) ? TAB_PROCESSES : TAB_VITALS;
-      if (shared_data.active_tab == TAB_VITALS) shared_data.proc_mode = PROC_MODE_NORMAL;
-      continue;
+    if (poll(fds, 3, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
     }
 
-    // Per-tab keys
-    if (shared_data.active_tab == TAB_PROCESSES) {
-      process_handle_key(event.key, event.ch);
+    if (fds[2].revents & POLLIN) {
+      char drain[64];
+      while (read(shared_data.wake_fds[0], drain, sizeof(drain)) > 0);
+      dirty = 1;
+    }
+
+    if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+      // Terminal went away, nothing left to draw on
+      shared_data.running = 0;
+      notify_collector();
+      break;
+    }
+
+    if ((fds[0].revents | fds[1].revents) & POLLIN) {
+      // Drain everything termbox can decode, resize included
+      Snapshot *snap = snapshot_acquire();
+      while (tb_peek_event(&event, 0) == TB_OK) {
+        if (!handle_event(&event, tb_width(), snap)) {
+          shared_data.running = 0;
+          notify_collector();
+          break;
+        }
+      }
+      snapshot_release(snap);
+      dirty = 1;
     }
   }
 
@@ -431,7 +1543,7 @@ static void draw_tabs(int width, ActiveTab active) {
   tb_printf(start_x + (int)strlen(left) + 1, 0, active == TAB_PROCESSES ? a_fg : i_fg, TB_DEFAULT, "%s", right);
 }
 
-static void render_process_view(int width, int height) {
+static void render_process_view(const Snapshot *snap, int width, int height) {
   int header_y = 1;
   int list_y = 2;
   int list_h = height - 4; // leave room for status bar above global footer
@@ -451,6 +1563,8 @@ static void render_process_view(int width, int height) {
     if (shared_data.proc_sort == PROC_SORT_MEM) sort_name = "MEM%";
     else if (shared_data.proc_sort == PROC_SORT_RSS) sort_name = "RSS";
     else if (shared_data.proc_sort == PROC_SORT_PID) sort_name = "PID";
+    else if (shared_data.proc_sort == PROC_SORT_GPU) sort_name = "GPU%";
+    else if (shared_data.proc_sort == PROC_SORT_VRAM) sort_name = "VRAM";
 
     // Draw column headers with per-column highlighting
     int x = 0;
@@ -480,6 +1594,16 @@ static void render_process_view(int width, int height) {
     // RSS
     tb_printf(x, header_y, shared_data.proc_sort == PROC_SORT_RSS ? on : off, TB_DEFAULT, "%8s", "RSS(KB)");
     x += 8;
+
+    // GPU% and VRAM, only with a GPU
+    if (shared_data.has_gpu) {
+      tb_printf(x++, header_y, off, TB_DEFAULT, " ");
+      tb_printf(x, header_y, shared_data.proc_sort == PROC_SORT_GPU ? on : off, TB_DEFAULT, "%6s", "GPU%");
+      x += 6;
+      tb_printf(x++, header_y, off, TB_DEFAULT, " ");
+      tb_printf(x, header_y, shared_data.proc_sort == PROC_SORT_VRAM ? on : off, TB_DEFAULT, "%9s", "VRAM(KB)");
+      x += 9;
+    }
     tb_printf(x, header_y, off, TB_DEFAULT, "  ");
     x += 2;
 
@@ -489,73 +1613,93 @@ static void render_process_view(int width, int height) {
     // Bottom status bar
     for (int i = 0; i < width; i++) tb_printf(i, status_y, TB_DEFAULT, TB_DEFAULT, " ");
     tb_printf(0, status_y, TB_DEFAULT | TB_BOLD, TB_DEFAULT,
-              " Tab=switch tabs   /=filter   1=CPU 2=MEM 3=RSS 4=PID   x=SIGTERM  X=SIGKILL   sort:%s ",
-              sort_name);
+              " Tab=switch tabs   /=filter   1=CPU 2=MEM 3=RSS 4=PID%s   x=SIGTERM  X=SIGKILL   sort:%s ",
+              shared_data.has_gpu ? " 5=GPU 6=VRAM" : "", sort_name);
   }
 
-  if (!shared_data.proc_entries || shared_data.proc_count <= 0) {
+  const ProcTable *t = snap->proc_table;
+  if (!t || snap->proc_sorted <= 0) {
     tb_printf(0, list_y, TB_YELLOW | TB_BOLD, TB_DEFAULT, "No process data yet (wait 1s) or insufficient permissions.");
     return;
   }
 
   if (shared_data.proc_selected < 0) shared_data.proc_selected = 0;
-  if (shared_data.proc_selected >= shared_data.proc_count) shared_data.proc_selected = shared_data.proc_count - 1;
+  if (shared_data.proc_selected >= snap->proc_sorted) shared_data.proc_selected = snap->proc_sorted - 1;
 
   if (shared_data.proc_selected < shared_data.proc_scroll) shared_data.proc_scroll = shared_data.proc_selected;
   if (shared_data.proc_selected >= shared_data.proc_scroll + list_h) shared_data.proc_scroll = shared_data.proc_selected - list_h + 1;
   if (shared_data.proc_scroll < 0) shared_data.proc_scroll = 0;
 
+  // Ask for the visible window plus a margin; deeper rows are sorted lazily
+  int wanted = shared_data.proc_scroll + list_h * (1 + PROC_SORT_MARGIN_PAGES);
+  shared_data.proc_rows_wanted = wanted;
+  if (wanted > snap->proc_sorted && snap->proc_sorted < t->count) notify_collector();
+
   for (int row = 0; row < list_h; row++) {
     int idx = shared_data.proc_scroll + row;
-    if (idx >= shared_data.proc_count) break;
+    if (idx >= snap->proc_sorted) break;
 
-    ProcessInfo *p = &shared_data.proc_entries[idx];
+    int r = t->order[idx];
 
     // More readable highlight: keep background default, just make text bold + cyan
     uintattr_t fg = (idx == shared_data.proc_selected) ? (TB_CYAN | TB_BOLD) : TB_DEFAULT;
     uintattr_t bg = TB_DEFAULT;
 
     char line[256];
-    snprintf(line, sizeof(line), "%-7d %-2c %6.1f %7.1f %8lu  %.60s",
-             p->pid, p->state ? p->state : '?', p->cpu_percent, p->mem_percent, p->rss_kb, p->comm);
+    if (shared_data.has_gpu) {
+      snprintf(line, sizeof(line), "%-7d %-2c %6.1f %7.1f %8lu %6.1f %9lu  %.60s",
+               t->pid[r], t->state[r] ? t->state[r] : '?', t->cpu_percent[r], t->mem_percent[r], t->rss_kb[r],
+               t->gpu_percent[r], t->vram_kb[r], t->comm[r]);
+    } else {
+      snprintf(line, sizeof(line), "%-7d %-2c %6.1f %7.1f %8lu  %.60s",
+               t->pid[r], t->state[r] ? t->state[r] : '?', t->cpu_percent[r], t->mem_percent[r], t->rss_kb[r], t->comm[r]);
+    }
 
     for (int x = 0; x < width; x++) tb_printf(x, list_y + row, fg, bg, " ");
     tb_printf(0, list_y + row, fg, bg, "%.*s", width, line);
   }
 }
 
-static void process_handle_key( uint16_t key, uint32_t ch) {
-  // Filter mode eats most keys
-  if (shared_data.proc_mode == PROC_MODE_FILTER) {
-    if (key == TB_KEY_ESC) {
-      // cancel: restore previous filter
-      strncpy(shared_data.proc_filter, shared_data.proc_filter_prev, sizeof(shared_data.proc_filter));
-      shared_data.proc_filter[sizeof(shared_data.proc_filter) - 1] = '\0';
-      shared_data.proc_mode = PROC_MODE_NORMAL;
-      return;
-    }
-    if (key == TB_KEY_ENTER) {
-      shared_data.proc_mode = PROC_MODE_NORMAL;
-      // apply: commit filter
-      strncpy(shared_data.proc_filter_prev, shared_data.proc_filter, sizeof(shared_data.proc_filter_prev));
-      shared_data.proc_filter_prev[sizeof(shared_data.proc_filter_prev) - 1] = '\0';
-      shared_data.proc_selected = 0;
-      shared_data.proc_scroll = 0;
-      return;
-    }
-    if (key == TB_KEY_BACKSPACE || key == TB_KEY_BACKSPACE2) {
-      size_t n = strlen(shared_data.proc_filter);
-      if (n > 0) shared_data.proc_filter[n - 1] = '\0';
-      return;
-    }
-    if (ch >= 32 && ch <= 126) {
-      size_t n = strlen(shared_data.proc_filter);
-      if (n + 1 < sizeof(shared_data.proc_filter)) {
-        shared_data.proc_filter[n] = (char)ch;
-        shared_data.proc_filter[n + 1] = '\0';
-      }
-      return;
+static void process_filter_key(uint16_t key, uint32_t ch) {
+  if (key == TB_KEY_ESC) {
+    // cancel: restore previous filter
+    strncpy(shared_data.proc_filter, shared_data.proc_filter_prev, sizeof(shared_data.proc_filter));
+    shared_data.proc_filter[sizeof(shared_data.proc_filter) - 1] = '\0';
+    shared_data.proc_mode = PROC_MODE_NORMAL;
+    return;
+  }
+  if (key == TB_KEY_ENTER) {
+    shared_data.proc_mode = PROC_MODE_NORMAL;
+    // apply: commit filter
+    strncpy(shared_data.proc_filter_prev, shared_data.proc_filter, sizeof(shared_data.proc_filter_prev));
+    shared_data.proc_filter_prev[sizeof(shared_data.proc_filter_prev) - 1] = '\0';
+    shared_data.proc_selected = 0;
+    shared_data.proc_scroll = 0;
+    return;
+  }
+  if (key == TB_KEY_BACKSPACE || key == TB_KEY_BACKSPACE2) {
+    size_t n = strlen(shared_data.proc_filter);
+    if (n > 0) shared_data.proc_filter[n - 1] = '\0';
+    return;
+  }
+  if (ch >= 32 && ch <= 126) {
+    size_t n = strlen(shared_data.proc_filter);
+    if (n + 1 < sizeof(shared_data.proc_filter)) {
+      shared_data.proc_filter[n] = (char)ch;
+      shared_data.proc_filter[n + 1] = '\0';
     }
+  }
+}
+
+static void process_handle_key(const Snapshot *snap, uint16_t key, uint32_t ch) {
+  // Selection stays within the rows that are already sorted
+  int proc_count = snap ? snap->proc_sorted : 0;
+
+  // Filter mode eats most keys; the stats thread reads proc_filter too
+  if (shared_data.proc_mode == PROC_MODE_FILTER) {
+    pthread_mutex_lock(&shared_data.data_mutex);
+    process_filter_key(key, ch);
+    pthread_mutex_unlock(&shared_data.data_mutex);
     return;
   }
 
@@ -573,26 +1717,25 @@ static void process_handle_key( uint16_t key, uint32_t ch) {
   if (ch == '2') { shared_data.proc_sort = PROC_SORT_MEM; return; }
   if (ch == '3') { shared_data.proc_sort = PROC_SORT_RSS; return; }
   if (ch == '4') { shared_data.proc_sort = PROC_SORT_PID; return; }
+  if (shared_data.has_gpu && ch == '5') { shared_data.proc_sort = PROC_SORT_GPU; return; }
+  if (shared_data.has_gpu && ch == '6') { shared_data.proc_sort = PROC_SORT_VRAM; return; }
 
   if (ch == 'j' || key == TB_KEY_ARROW_DOWN) {
-    if (shared_data.proc_selected < shared_data.proc_count - 1) shared_data.proc_selected++;
+    if (shared_data.proc_selected < proc_count - 1) shared_data.proc_selected++;
   } else if (ch == 'k' || key == TB_KEY_ARROW_UP) {
     if (shared_data.proc_selected > 0) shared_data.proc_selected--;
   } else if (key == TB_KEY_PGDN) {
     shared_data.proc_selected += 10;
-    if (shared_data.proc_selected >= shared_data.proc_count) shared_data.proc_selected = shared_data.proc_count - 1;
+    if (shared_data.proc_selected >= proc_count) shared_data.proc_selected = proc_count - 1;
+    if (shared_data.proc_selected < 0) shared_data.proc_selected = 0;
   } else if (key == TB_KEY_PGUP) {
     shared_data.proc_selected -= 10;
     if (shared_data.proc_selected < 0) shared_data.proc_selected = 0;
-  } else if (ch == 'x') {
-    if (shared_data.proc_entries && shared_data.proc_count > 0) {
-      int pid = shared_data.proc_entries[shared_data.proc_selected].pid;
-      proc_kill(pid, SIGTERM);
-    }
-  } else if (ch == 'X') {
-    if (shared_data.proc_entries && shared_data.proc_count > 0) {
-      int pid = shared_data.proc_entries[shared_data.proc_selected].pid;
-      proc_kill(pid, SIGKILL);
+  } else if (ch == 'x' || ch == 'X') {
+    if (snap && snap->proc_table && shared_data.proc_selected < proc_count) {
+      const ProcTable *t = snap->proc_table;
+      int pid = t->pid[t->order[shared_data.proc_selected]];
+      proc_kill(pid, ch == 'x' ? SIGTERM : SIGKILL);
     }
   }
 }
@@ -601,99 +1744,165 @@ void setup_containers() {
   pthread_mutex_lock(&shared_data.data_mutex);
   
   // Set up CPU and memory boxes
-  shared_data.cpu_box = (Container){BOX, .box = {shared_data.cpu_list, shared_data.cpu_title, draw_bars_perc}};
-  shared_data.mem_box = (Container){BOX, .box = {shared_data.mem_list, shared_data.mem_title, draw_bars_perc}};
-  shared_data.gpu_box = (Container){BOX, .box = {shared_data.gpu_list, shared_data.gpu_title, draw_bars_perc}};
-  shared_data.vram_box = (Container){BOX, .box = {shared_data.vram_list, shared_data.vram_title, draw_bars_perc}};
-  shared_data.net_up_box = (Container){BOX, .box = {shared_data.net_up_list, shared_data.net_up_title, draw_scale_bars}};
-  shared_data.net_down_box = (Container){BOX, .box = {shared_data.net_down_list, shared_data.net_down_title, draw_scale_bars}};
+  shared_data.cpu_box = (Container){BOX, .box = {SERIES_CPU, draw_bars_perc}};
+  shared_data.mem_box = (Container){BOX, .box = {SERIES_MEM, draw_bars_perc}};
+  shared_data.gpu_box = (Container){BOX, .box = {SERIES_GPU_ALL, draw_bars_perc}};
+  shared_data.vram_box = (Container){BOX, .box = {SERIES_VRAM_ALL, draw_bars_perc}};
+  for (int i = 0; i < MAX_GPUS; i++) {
+    shared_data.gpu_boxes[i] = (Container){BOX, .box = {GPU_SERIES(i), draw_bars_perc}};
+    shared_data.vram_boxes[i] = (Container){BOX, .box = {VRAM_SERIES(i), draw_bars_perc}};
+  }
+  shared_data.net_up_box = (Container){BOX, .box = {SERIES_NET_UP, draw_scale_bars}};
+  shared_data.net_down_box = (Container){BOX, .box = {SERIES_NET_DOWN, draw_scale_bars}};
+  shared_data.cores_box = (Container){.type = HEATMAP};
 
   // CPU+RAM row when GPU exists
   shared_data.hbox_cpu_mem_children[0] = &shared_data.cpu_box;
   shared_data.hbox_cpu_mem_children[1] = &shared_data.mem_box;
   shared_data.hbox_cpu_mem = (Container){HBOX, .group = {shared_data.hbox_cpu_mem_children, 2}};
 
-  // GPU+VRAM row when GPU exists
+  // GPU+VRAM row when GPU exists; per-GPU boxes are added per snapshot
   shared_data.hbox_gpu_mem_children[0] = &shared_data.gpu_box;
   shared_data.hbox_gpu_mem_children[1] = &shared_data.vram_box;
   shared_data.hbox_gpu_mem = (Container){HBOX, .group = {shared_data.hbox_gpu_mem_children, 2}};
+  shared_data.layout_gpu_count = 0;
   
   // Create network container
   shared_data.hbox_net_children[0] = &shared_data.net_up_box;
   shared_data.hbox_net_children[1] = &shared_data.net_down_box;
   shared_data.hbox_net = (Container){HBOX, .group = {shared_data.hbox_net_children, 2}};
   
-  // Set up disk boxes
-  for (int i = 0; i < shared_data.disk_count; i++) {
-    shared_data.disk_boxes[i] = (Container){BOX, .box = {shared_data.disk_lists[i], shared_data.disk_titles[i], draw_bars_perc}};
-    shared_data.hbox_disk_children[i] = &shared_data.disk_boxes[i];
-  }
-  
-  // Create disk container (horizontal layout)
-  shared_data.hbox_disks = (Container){HBOX, .group = {shared_data.hbox_disk_children, shared_data.disk_count}};
+  // Create disk container (horizontal layout); boxes are added per snapshot
+  for (int i = 0; i < MAX_DISKS; i++) shared_data.hbox_disk_children[i] = &shared_data.disk_boxes[i];
+  shared_data.hbox_disks = (Container){HBOX, .group = {shared_data.hbox_disk_children, 0}};
+  shared_data.layout_disk_count = 0;
   
   // Main container
+  int rows = 0;
   if (shared_data.has_gpu) {
-    shared_data.vbox_children[0] = &shared_data.hbox_cpu_mem;
-    shared_data.vbox_children[1] = &shared_data.hbox_gpu_mem;
-    shared_data.vbox_children[2] = &shared_data.hbox_net;
-    shared_data.vbox_children[3] = &shared_data.hbox_disks;
+    shared_data.vbox_children[rows++] = &shared_data.hbox_cpu_mem;
   } else {
     // Keep existing layout when no GPU
-    shared_data.vbox_children[0] = &shared_data.cpu_box;
-    shared_data.vbox_children[1] = &shared_data.mem_box;
-    shared_data.vbox_children[2] = &shared_data.hbox_net;
-    shared_data.vbox_children[3] = &shared_data.hbox_disks;
+    shared_data.vbox_children[rows++] = &shared_data.cpu_box;
+  }
+  // A heatmap of a single core would only repeat the CPU box
+  if (shared_data.core_count > 1) shared_data.vbox_children[rows++] = &shared_data.cores_box;
+  if (shared_data.has_gpu) {
+    shared_data.vbox_children[rows++] = &shared_data.hbox_gpu_mem;
+  } else {
+    shared_data.vbox_children[rows++] = &shared_data.mem_box;
   }
-  shared_data.vbox_main = (Container){VBOX, .group = {shared_data.vbox_children, 4}};
+  shared_data.vbox_children[rows++] = &shared_data.hbox_net;
+  shared_data.vbox_children[rows++] = &shared_data.hbox_disks;
+  shared_data.vbox_main = (Container){VBOX, .group = {shared_data.vbox_children, rows}};
   
   pthread_mutex_unlock(&shared_data.data_mutex);
 }
 
+// One GPU/VRAM pair per device while each box stays at least
+// GPU_BOX_MIN_WIDTH wide, otherwise the aggregate pair. Render thread only.
+static void layout_gpus(const Snapshot *snap, int width) {
+  int count = snap->gpu_count;
+  if (count < 2 || width / (count * 2) < GPU_BOX_MIN_WIDTH) count = 0;
+  if (count == shared_data.layout_gpu_count) return;
+
+  Container **children = shared_data.hbox_gpu_mem_children;
+  if (count == 0) {
+    children[0] = &shared_data.gpu_box;
+    children[1] = &shared_data.vram_box;
+  }
+  for (int i = 0; i < count; i++) {
+    children[i * 2] = &shared_data.gpu_boxes[i];
+    children[i * 2 + 1] = &shared_data.vram_boxes[i];
+  }
+  shared_data.hbox_gpu_mem.group.count = count ? count * 2 : 2;
+  shared_data.layout_gpu_count = count;
+}
+
+// Disk boxes follow the disks in the snapshot, so hotplugged disks get a
+// box and removed ones lose theirs. Render thread only.
+static void layout_disks(const Snapshot *snap) {
+  static const draw_bars metric_draw[DISK_METRIC_COUNT] = {
+    [DISK_BUSY] = draw_bars_perc,
+    [DISK_READ_BPS] = draw_scale_bars,
+    [DISK_WRITE_BPS] = draw_scale_bars,
+    [DISK_READ_IOPS] = draw_scale_iops,
+    [DISK_WRITE_IOPS] = draw_scale_iops,
+    [DISK_AWAIT] = draw_scale_usec,
+    [DISK_QUEUE] = draw_scale_count,
+    [DISK_DISCARD_IOPS] = draw_scale_iops,
+    [DISK_FLUSH_IOPS] = draw_scale_iops,
+  };
+  DiskMetric metric = shared_data.disk_metric;
+  int count = snap->disk_count;
+  int same = count == shared_data.layout_disk_count && metric == shared_data.layout_disk_metric;
+  for (int i = 0; same && i < count; i++) same = snap->disks[i].slot == shared_data.layout_disk_slots[i];
+  if (same) return;
+
+  for (int i = 0; i < count; i++) {
+    shared_data.disk_boxes[i] = (Container){BOX, .box = {DISK_SERIES(snap->disks[i].slot, metric), metric_draw[metric]}};
+    shared_data.layout_disk_slots[i] = snap->disks[i].slot;
+  }
+  shared_data.layout_disk_count = count;
+  shared_data.layout_disk_metric = metric;
+  shared_data.hbox_disks.group.count = count;
+}
+
 void cleanup_resources() {
   // Free resources and clean up
   tb_shutdown();
+  // Before the snapshot pool goes: a scrape may hold a snapshot
+  if (shared_data.metrics_addr) metrics_stop(&shared_data.metrics);
   
-  // Free lists
-  list_free(shared_data.cpu_list);
-  list_free(shared_data.mem_list);
-  list_free(shared_data.gpu_list);
-  list_free(shared_data.vram_list);
-  list_free(shared_data.net_up_list);
-  list_free(shared_data.net_down_list);
-  
-  for (int i = 0; i < shared_data.disk_count; i++) {
-    list_free(shared_data.disk_lists[i]);
+  // Free history
+  for (int i = 0; i < SERIES_COUNT; i++) {
+    series_free(&shared_data.history[i]);
   }
   
-  if (shared_data.disk_info) free_disk_info(shared_data.disk_info);
-  if (shared_data.proc_entries) proc_free(shared_data.proc_entries);
+  heatmap_free(&shared_data.core_history);
+  free(shared_data.core_percs);
+  free(shared_data.core_column);
+
+  snapshot_pool_free();
+  proc_table_unref(shared_data.proc_table);
   proc_free_ctx(&shared_data.proc_ctx);
+  sysstat_free(&shared_data.sys_stat[0]);
+  sysstat_free(&shared_data.sys_stat[1]);
+  disk_inventory_free();
+  gpu_shutdown();
+  if (shared_data.uevent_fd >= 0) close(shared_data.uevent_fd);
+  if (shared_data.daemon || shared_data.attached) shm_ring_close(&shared_data.shm);
+  if (shared_data.record_path) rec_close(&shared_data.recorder);
+  if (shared_data.replaying) replay_close(&shared_data.replay);
+  if (shared_data.flight_every) flight_free(&shared_data.flight);
 
   // Destroy synchronization primitives
   pthread_mutex_destroy(&shared_data.data_mutex);
-  pthread_cond_destroy(&shared_data.data_updated);
+  close(shared_data.wake_fds[0]);
+  close(shared_data.wake_fds[1]);
+  close(shared_data.collect_wake_fds[0]);
+  close(shared_data.collect_wake_fds[1]);
+  close(shared_data.tick_fd);
 }
 
 void handle_signal(int signal) {
   // Set the running flag to false to terminate threads
   shared_data.running = 0;
+  notify_render();
+  notify_collector();
 }
 
-// Keep the original drawing functions unchanged
-void draw_box(int x, int y, int x2, int y2, List *list, char* title, draw_bars draw_b) {
-  short skipLine = 0;
-  int hLine = (y2 - y)/2 + y -1;
+// SIGUSR1: the stats thread writes the flight recorder out between passes
+void handle_flight_signal(int signal) {
+  (void)signal;
+  shared_data.flight_requested = 1;
+  notify_collector();
+}
 
-  char lineChar[2] = {(y2-y)%2==0?'_':'-'};
-  hLine+=(lineChar[0]=='-'?1:0);
+static void draw_frame(int x, int y, int x2, int y2, const char *title) {
   for(int i=x+1;i<x2-1;i++){
     tb_printf(i, y, TB_DEFAULT, TB_DEFAULT, box[4]); 
     tb_printf(i, y2-1, TB_DEFAULT, TB_DEFAULT, box[4]);
-    if(skipLine){
-        tb_printf(i , hLine, TB_DEFAULT, TB_DEFAULT, lineChar);
-    }
-    skipLine = !skipLine;
   }
   for(int i=y+1;i<y2-1;i++){
     tb_printf(x, i, TB_DEFAULT, TB_DEFAULT, box[5]);
@@ -704,22 +1913,82 @@ void draw_box(int x, int y, int x2, int y2, List *list, char* title, draw_bars d
   tb_printf(x, y2-1, TB_DEFAULT, TB_DEFAULT, box[2]);
   tb_printf(x2-1, y2-1, TB_DEFAULT, TB_DEFAULT, box[3]);
   tb_printf(x+2, y, TB_DEFAULT | TB_BOLD, TB_DEFAULT, " %s ", title);
+}
 
-  draw_b(list, (x2-1)-(x+1), (y2-1)-(y+1), x+1, y+1);
+// Keep the original drawing functions unchanged
+void draw_box(int x, int y, int x2, int y2, const Series *series, const char *title, draw_bars draw_b) {
+  short skipLine = 0;
+  int hLine = (y2 - y)/2 + y -1;
+
+  char lineChar[2] = {(y2-y)%2==0?'_':'-'};
+  hLine+=(lineChar[0]=='-'?1:0);
+  for(int i=x+1;i<x2-1;i++){
+    if(skipLine){
+        tb_printf(i , hLine, TB_DEFAULT, TB_DEFAULT, lineChar);
+    }
+    skipLine = !skipLine;
+  }
+  draw_frame(x, y, x2, y2, title);
+
+  draw_b(series, (x2-1)-(x+1), (y2-1)-(y+1), x+1, y+1);
+}
+
+static uintattr_t heat_color(int value) {
+  if (value < 5) return 0;
+  if (value < 25) return TB_BLUE;
+  if (value < 50) return TB_GREEN;
+  if (value < 75) return TB_YELLOW;
+  return TB_RED;
 }
 
-void draw_bars_perc(List *list, int width, int height, int min_x, int min_y) {
+static int heat_band_max(const unsigned char *column, int rows, int first, int span) {
+  int last = first + span < rows ? first + span : rows;
+  int value = 0;
+  for (int r = first; r < last; r++) {
+    if (column[r] > value) value = column[r];
+  }
+  return value;
+}
 
-  int count = list->count;
-  Node *node = list->first;
-  while(count > width){
-    node = node->next;
-    count--;
+// One column per sample and two cores per text row (upper/lower half
+// block). With more cores than half rows, neighbouring cores share a half
+// cell that shows their max, so a single pegged core still stands out and
+// the number of cells drawn never exceeds the box area.
+void draw_heatmap(const Heatmap *map, int width, int height, int min_x, int min_y) {
+  int rows = map->rows;
+  if (rows == 0 || width <= 0 || height <= 0) return;
+
+  int halves = height * 2;
+  int span = (rows + halves - 1) / halves;
+  int bands = (rows + span - 1) / span;
+
+  int count = map->count;
+  int start = count > width ? count - width : 0;
+  int x = width - (count - start);
+  for (int i = start; i < count && x < width; i++) {
+    const unsigned char *column = heatmap_column(map, i);
+    for (int b = 0; b < bands; b += 2) {
+      uintattr_t top = heat_color(heat_band_max(column, rows, b * span, span));
+      uintattr_t bottom = b + 1 < bands ? heat_color(heat_band_max(column, rows, (b + 1) * span, span)) : 0;
+      if (top) {
+        tb_printf(min_x + x, min_y + b / 2, top, bottom ? bottom : TB_DEFAULT, "▀");
+      } else if (bottom) {
+        tb_printf(min_x + x, min_y + b / 2, bottom, TB_DEFAULT, "▄");
+      }
+    }
+    x++;
   }
-  int x = width - count;
-  while (node != NULL && x < width) {
-    int bar_h = (node_get_int(node) * height) / 100; // Full blocks
-    int bar_h_e = ((node_get_int(node) * height) % 100) * 8 / 100; // Extra fractional block
+}
+
+void draw_bars_perc(const Series *series, int width, int height, int min_x, int min_y) {
+
+  int count = series->count;
+  int start = count > width ? count - width : 0;
+  int x = width - (count - start);
+  for (int i = start; i < count && x < width; i++) {
+    int value = (int)series_at(series, i);
+    int bar_h = (value * height) / 100; // Full blocks
+    int bar_h_e = ((value * height) % 100) * 8 / 100; // Extra fractional block
     // Draw blocks from bottom to top
     for (int y = height - 1; y >= 0; y--) {
       uintattr_t color = TB_RED;
@@ -733,39 +2002,64 @@ void draw_bars_perc(List *list, int width, int height, int min_x, int min_y) {
       }
     }
 
-    node = node->next;
     x++;
   }
 }
 
-void draw_scale_bars(List *list, int width, int height, int min_x, int min_y) {
-  int count = list->count;
-  Node *node = list->first;
-  while(count > width){
-    node = node->next;
-    count--;
-  }
-  Node *node_ref = node; 
+static void format_iops(char *buffer, size_t size, unsigned long iops) {
+  if (iops >= 10000) snprintf(buffer, size, "%.1fk IO/s", iops / 1000.0);
+  else snprintf(buffer, size, "%lu IO/s", iops);
+}
+
+static void format_usec(char *buffer, size_t size, unsigned long usec) {
+  snprintf(buffer, size, "%.2f ms", usec / 1000.0);
+}
+
+static void format_count(char *buffer, size_t size, unsigned long count) {
+  snprintf(buffer, size, "%lu", count);
+}
+
+static void draw_scale_bars_fmt(const Series *series, int width, int height, int min_x, int min_y, format_value fmt);
+
+void draw_scale_bars(const Series *series, int width, int height, int min_x, int min_y) {
+  draw_scale_bars_fmt(series, width, height, min_x, min_y, format_speed);
+}
+
+void draw_scale_iops(const Series *series, int width, int height, int min_x, int min_y) {
+  draw_scale_bars_fmt(series, width, height, min_x, min_y, format_iops);
+}
+
+void draw_scale_usec(const Series *series, int width, int height, int min_x, int min_y) {
+  draw_scale_bars_fmt(series, width, height, min_x, min_y, format_usec);
+}
+
+void draw_scale_count(const Series *series, int width, int height, int min_x, int min_y) {
+  draw_scale_bars_fmt(series, width, height, min_x, min_y, format_count);
+}
+
+// Bars scaled to the largest visible sample, labelled with fmt
+static void draw_scale_bars_fmt(const Series *series, int width, int height, int min_x, int min_y, format_value fmt) {
+  int count = series->count;
+  int start = count > width ? count - width : 0;
   unsigned long max_value = 1;
   short max_value_change = 0;
-  while (node != NULL) {
-    unsigned long curr=node_get_u_long(node);
+  for (int i = start; i < count; i++) {
+    unsigned long curr = (unsigned long)series_at(series, i);
     if(curr>0) max_value_change=1;
     max_value = curr > max_value ? curr : max_value;
-      node = node->next;
   }
 
   char max_str[50] = "";
-  format_speed(max_str, sizeof(max_str),max_value_change? max_value:0);
+  fmt(max_str, sizeof(max_str),max_value_change? max_value:0);
   char max_str_present[50] = "max: ";
   strcat(max_str_present, max_str);
   tb_printf(min_x + width - (strlen(max_str_present)) - 2, min_y -1, TB_DEFAULT | TB_BOLD, TB_DEFAULT, " %s ", max_str_present);
   
-  int x = width - count;
-  node = node_ref;
-  while (node != NULL && x < width) {
-    int bar_h = (int)((node_get_u_long(node) * height) / max_value);
-    int bar_h_e = (int)(((node_get_u_long(node) * height) % max_value) * 8 / max_value);
+  int x = width - (count - start);
+  for (int i = start; i < count && x < width; i++) {
+    unsigned long value = (unsigned long)series_at(series, i);
+    int bar_h = (int)((value * height) / max_value);
+    int bar_h_e = (int)(((value * height) % max_value) * 8 / max_value);
 
     for (int y = height - 1; y >= 0; y--) {
       if (y >= height - bar_h) {
@@ -774,24 +2068,27 @@ void draw_scale_bars(List *list, int width, int height, int min_x, int min_y) {
         tb_printf(min_x + x, min_y + y, TB_BLUE, TB_DEFAULT, "%s", blocks[bar_h_e - 1]);
       }
     }
-    node = node->next;
     x++;
   }
 }
 
-void container_render(int x, int y, int width, int height, Container *container) {
+void container_render(const Snapshot *snap, int x, int y, int width, int height, Container *container) {
   if (!container) return;  // Add null check to prevent segfault
   
   if (container->type == BOX) {
-    draw_box(x, y, x + width, y + height, container->box.list, container->box.title, container->box.draw_func);
+    draw_box(x, y, x + width, y + height, &snap->series[container->box.series],
+             snap->titles[container->box.series], container->box.draw_func);
+  } else if (container->type == HEATMAP) {
+    draw_frame(x, y, x + width, y + height, snap->cores_title);
+    draw_heatmap(&snap->cores, width - 2, height - 2, x + 1, y + 1);
   } else if (container->type == HBOX) {
-    container_render_hbox(x, y, width, height, container);
+    container_render_hbox(snap, x, y, width, height, container);
   } else if (container->type == VBOX) {
-    container_render_vbox(x, y, width, height, container);
+    container_render_vbox(snap, x, y, width, height, container);
   }
 }
 
-void container_render_vbox(int x, int y, int width, int height, Container *container) {
+void container_render_vbox(const Snapshot *snap, int x, int y, int width, int height, Container *container) {
   if (!container || !container->group.count) return;  // Add null check
   
   int box_height = height / container->group.count;
@@ -799,12 +2096,12 @@ void container_render_vbox(int x, int y, int width, int height, Container *conta
     int h = (i == container->group.count - 1) ? height - i * box_height : box_height;
     Container *child = container->group.children[i];
     if (child) {  // Add null check for child
-      container_render(x, y + i * box_height, width, h, child);
+      container_render(snap, x, y + i * box_height, width, h, child);
     }
   }
 }
 
-void container_render_hbox(int x, int y, int width, int height, Container *container) {
+void container_render_hbox(const Snapshot *snap, int x, int y, int width, int height, Container *container) {
   if (!container || !container->group.count) return;  // Add null check
   
   int box_width = width / container->group.count;
@@ -812,17 +2109,7 @@ void container_render_hbox(int x, int y, int width, int height, Container *conta
     int w = (i == container->group.count - 1) ? width - i * box_width : box_width; 
     Container *child = container->group.children[i];
     if (child) {  // Add null check for child
-      container_render(x + i * box_width, y, w, height, child);
+      container_render(snap, x + i * box_width, y, w, height, child);
     }
   }
 }
-
-void list_trim(List *list, int width){
-  while (list->count > width) {
-    Node *old_node = list->first;
-    list->first = old_node->next;
-    free(old_node->value);
-    free(old_node);
-    list->count--;
-  }
-}